@@ -0,0 +1,77 @@
+#include "Interpreter.h"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+namespace {
+
+struct Measure
+{
+    double seconds;
+    unsigned long long steps;
+};
+
+struct Configuration
+{
+    char const* name;
+    Interpreter::Dispatch dispatch;
+    bool optimizations;
+};
+
+Measure run(char const* source, Configuration const& configuration)
+{
+    std::istringstream is(source);
+    Lexer lexer({
+        [&is]{ return is.peek(); },
+        [&is]{ return is.get(); },
+        [&is]{ return is.peek() == decltype(is)::traits_type::eof(); }
+    });
+    Parser parser{lexer};
+    Interpreter interpreter;
+    interpreter.dispatch() = configuration.dispatch;
+    interpreter.optimizations() = configuration.optimizations;
+    interpreter.feed(parser.parse());
+
+    auto start = std::chrono::steady_clock::now();
+    interpreter.execute();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return {elapsed.count(), interpreter.stepCount()};
+}
+
+}
+
+int main()
+{
+    char const* const scripts[][2] = {
+        {"counting loop", "var i = 0; var s = 0; while(i < 50000){ s += i * 2 - 1; i += 1; }"},
+        {"member access", "var o = {a: 1, b: 2}; var i = 0; while(i < 30000){ o.a = o.a + o.b; i += 1; }"},
+        {"function call", "var f = function(x){ return x + 1; }; var i = 0; while(i < 20000){ i = f(i); }"},
+    };
+    Configuration const configurations[] = {
+        {"variant             ", Interpreter::Dispatch::Variant, false},
+        {"switch              ", Interpreter::Dispatch::Switch, false},
+        {"threaded            ", Interpreter::Dispatch::Threaded, false},
+        {"switch + optimized  ", Interpreter::Dispatch::Switch, true},
+        {"threaded + optimized", Interpreter::Dispatch::Threaded, true},
+    };
+
+    for(auto& [name, source] : scripts){
+        std::cout << name << '\n';
+        for(auto& configuration : configurations){
+            // best of a few runs, to keep scheduling noise out of the comparison
+            auto measure = run(source, configuration);
+            for(int i = 1; i < 3; ++i){
+                auto other = run(source, configuration);
+                if(other.seconds < measure.seconds){
+                    measure = other;
+                }
+            }
+            std::cout << "  " << configuration.name << ' '
+                      << std::setw(10) << measure.steps << " steps "
+                      << std::fixed << std::setprecision(2) << std::setw(8) << measure.seconds * 1e9 / measure.steps << " ns/step "
+                      << std::setw(8) << measure.seconds * 1e3 << " ms\n";
+        }
+    }
+}
@@ -29,8 +29,13 @@ function generate_options(jln_opt)
    end
 end
 
+newoption {
+   trigger = "single-threaded-var",
+   description = "Count var references without atomic operations, every value must stay on the thread that created it"
+}
+
 workspace "Cpp.js"
-   configurations { "Debug", "Release", "Tests" }
+   configurations { "Debug", "Release", "Tests", "Bench" }
 
 project "Cpp.js"
    kind "ConsoleApp"
@@ -60,4 +65,14 @@ project "Cpp.js"
       files { "../console/**.h", "../console/**.cpp" }
       defines { "NDEBUG" }
       optimize "On"
-      generate_options {warnings='on'}
\ No newline at end of file
+      generate_options {warnings='on'}
+
+   filter "configurations:Bench"
+      includedirs { "../src" }
+      files { "../bench/**.h", "../bench/**.cpp" }
+      defines { "NDEBUG" }
+      optimize "On"
+      generate_options {warnings='on'}
+
+   filter "options:single-threaded-var"
+      defines { "VAR_ATOMIC_REFCOUNT=0" }
@@ -1,6 +1,29 @@
 #include "Interpreter.h"
 
+#include <cmath>
+#include <cstdlib>
 #include <iostream>
+#include <iterator>
+#include <limits>
+
+namespace {
+
+/// Sizes and offsets given by scripts, up to 1 GiB: NaN or a negative number cannot be cast to size_t
+constexpr double maxByteLength = 1 << 30;
+
+size_t toIndex(var const& value, char const* what, double max = maxByteLength)
+{
+    if(value.is_undefined()){
+        return 0;
+    }
+    auto d = value.to_double();
+    if(!(d >= 0. && d <= max && d == std::trunc(d))){
+        throw std::invalid_argument(std::string("RangeError: Invalid ") + what + ": " + value.to_string());
+    }
+    return static_cast<size_t>(d);
+}
+
+} // namespace
 
 int main()
 {
@@ -14,7 +37,21 @@ int main()
 
     bool debug_parsetree = false;
 
-    interpreter.globalEnvironment() = var{{
+    // TypedArray(length) or TypedArray(buffer[, byteOffset[, length]]), `new` is not supported yet
+    auto typedArray = [](var::element_type type){
+        return var([type](auto args)->var{
+            if(args[0].is_array_buffer()){
+                return var::typed_array(type, args[0],
+                                        toIndex(args[1], "typed array offset"),
+                                        args.size() >= 3 ? toIndex(args[2], "typed array length") : var::npos);
+            }
+            // 8 bytes for the largest elements
+            return var::typed_array(type, toIndex(args[0], "typed array length", maxByteLength / 8));
+        });
+    };
+
+    // Added next to the builtins of the interpreter
+    for(auto& [name, value] : std::unordered_map<std::string, var>{
         {"console", {{
             {"log", var(
                 [](auto args){
@@ -24,9 +61,15 @@ int main()
                 })
             }
         }}},
-        {"exit", var(
-            [](auto args)->var{
-                exit(args.size() >= 1 ? static_cast<int>(args[0].to_double()) : 0);
+        {"exit", var::bind<&std::exit>()},
+        {"ArrayBuffer", var([](auto args){ return var::array_buffer(toIndex(args[0], "array buffer length")); })},
+        {"Float64Array", typedArray(var::element_type::Float64)},
+        {"Int32Array", typedArray(var::element_type::Int32)},
+        {"Uint8Array", typedArray(var::element_type::Uint8)},
+        {"optimize", var(
+            [&interpreter](auto args)->var{
+                interpreter.optimizations() = args.size() >= 1 ? args[0].to_bool() : true;
+                return var{};
             })
         },
         {"debug", var(
@@ -39,7 +82,9 @@ int main()
                 return var{};
             })
         }
-    }};
+    }){
+        interpreter.globalEnvironment()[name] = value;
+    }
 
     while(true){
         std::cout << "Cpp.js> " << std::flush;
@@ -62,6 +107,8 @@ int main()
             std::cout << '\n' << interpreter.execute() << '\n';
         }catch(Interpreter::unimplemented_error& e){
             std::cout << '\n' << "Error: " << e.what() << " is not implemented yet." << '\n';
+        }catch(std::invalid_argument& e){
+            std::cout << '\n' << e.what() << '\n';
         }
         std::cin.clear();
     }
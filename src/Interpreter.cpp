@@ -1,37 +1,227 @@
 #include "Interpreter.h"
+#include "Numeric.h"
 
+#include <algorithm>
 #include <cassert>
+#include <functional>
 #include <iostream>
 
 Interpreter::Interpreter()
 {
-    //ctor
+    m_globalEnvironment["Numeric"] = Numeric::library();
+}
+
+Interpreter::Interpreter(Snapshot const& snapshot):
+    Interpreter(Blank{})
+{
+    copyFrom(*snapshot.m_interpreter);
+}
+
+Interpreter::~Interpreter()
+{
+    // The values still alive keep the account until they are destroyed
+    m_memory->release();
+}
+
+Interpreter::Function::Function(Interpreter& creator, std::shared_ptr<FunctionCode const> functionCode,
+                                std::vector<std::pair<var::string_t const*, var>> captureValues, var enclosingScope):
+    interpreter(creator.m_lifetime),
+    definition(std::move(functionCode)),
+    captures(std::move(captureValues)),
+    scope(std::move(enclosingScope))
+{}
+
+var::properties_t Interpreter::Function::locals() const
+{
+    var::properties_t ret;
+    ret.reserve(captures.size() + definition->params.size());
+    for(auto& [name, value] : captures){
+        ret.emplace(*name, value);
+    }
+    return ret;
+}
+
+Interpreter& Interpreter::Function::owner() const
+{
+    auto lifetime = interpreter.lock();
+    if(!lifetime){
+        throw std::logic_error("Interpreter::Function: the interpreter of the function was destroyed");
+    }
+    return **lifetime;
+}
+
+var Interpreter::Function::operator()(var::args_t args)
+{
+    return owner().call(var{shared_from_this()}, args);
+}
+
+void Interpreter::Function::for_each_reference(std::function<void(var const&)> const& visit) const
+{
+    for(auto& [name, value] : captures){
+        visit(value);
+    }
+    visit(scope);
+}
+
+size_t Interpreter::Function::memory_size() const
+{
+    return sizeof(Function) + captures.capacity() * sizeof(captures[0]);
+}
+
+auto Interpreter::snapshot() const -> Snapshot
+{
+    if(!m_executionStack.empty()){
+        throw std::logic_error("Interpreter::snapshot: the execution stack is not empty");
+    }
+    std::shared_ptr<Interpreter> frozen(new Interpreter(Blank{}));
+    frozen->copyFrom(*this);
+    return Snapshot(std::move(frozen));
+}
+
+void Interpreter::copyFrom(Interpreter const& source)
+{
+    var::memory_account::scope memory(m_memory);
+    // Script functions are bound to this interpreter, with copies of what they capture
+    var::cloner clone([this](var const& function, var::cloner& cloneGraph) -> var{
+        auto original = dynamic_cast<Function const*>(function.script_function());
+        if(!original){
+            return function;
+        }
+        std::vector<std::pair<var::string_t const*, var>> captures;
+        captures.reserve(original->captures.size());
+        auto copy = std::make_shared<Function>(*this, original->definition, std::move(captures), var{});
+        var ret{copy};
+        cloneGraph.remember(function, ret);
+        for(auto& [name, value] : original->captures){
+            copy->captures.emplace_back(name, cloneGraph(value));
+        }
+        copy->scope = cloneGraph(original->scope);
+        return ret;
+    });
+    m_globalEnvironment = clone(source.m_globalEnvironment);
+    m_parseTrees = source.m_parseTrees;
+    m_optimizations = source.m_optimizations;
+    m_dispatch = source.m_dispatch;
+}
+
+auto Interpreter::compile(Parser::ParseTree tree, bool optimizations) -> Script
+{
+    if(optimizations){
+        Optimizer().optimize(tree.root());
+    }
+    return Script(compileCode(std::move(tree), optimizations));
 }
 
 void Interpreter::feed(Parser::ParseTree tree)
 {
-    m_parseTrees.push_back(std::make_unique<Parser::ParseTree>(std::move(tree)));
-    ExecutionContext ctx {
-        Realm{},
-        var{},
-        m_globalEnvironment,
-        m_parseTrees.back()->root(),
-        m_parseTrees.back()->root(),
-        m_parseTrees.back()->root(),
-        {}
-    };
-    m_executionStack.push(std::move(ctx));
+    var::memory_account::scope scope(m_memory);
+    auto script = compile(std::move(tree), m_optimizations);
+    m_memory->charge(var::memory_account::kind::parse_trees, memorySize(*script.m_code));
+    feed(std::move(script));
+}
+
+void Interpreter::feed(Script script)
+{
+    m_parseTrees.push_back(std::move(script.m_code));
+    pushContext(*m_parseTrees.back(), m_globalEnvironment);
 }
 
 var Interpreter::execute()
 {
-    auto& ctx = m_executionStack.top();
-    ctx.currentNode = ctx.code;
-    ctx.previousNode = ctx.currentNode;
+    var::memory_account::scope scope(m_memory);
+    m_completionValue = run(0).value;
+    return m_completionValue;
+}
+
+auto Interpreter::execute_for(unsigned long long maxSteps) -> Status
+{
+    var::memory_account::scope scope(m_memory);
+    m_stepLimit = maxSteps < noStepLimit - m_stepCount ? m_stepCount + maxSteps : noStepLimit;
     CompletionRecord cr;
-    while(!m_executionStack.empty()){
-        cr = execute_step();
+    try {
+        cr = run(0);
+    } catch(...) {
+        m_stepLimit = noStepLimit;
+        throw;
+    }
+    m_stepLimit = noStepLimit;
+    if(!m_executionStack.empty()){
+        return Status::Suspended;
+    }
+    m_completionValue = std::move(cr.value);
+    return Status::Completed;
+}
+
+auto Interpreter::execute_until(std::chrono::steady_clock::time_point deadline) -> Status
+{
+    constexpr unsigned long long sliceSteps = 1024;
+    do {
+        if(execute_for(sliceSteps) == Status::Completed){
+            return Status::Completed;
+        }
+    } while(std::chrono::steady_clock::now() < deadline);
+    return Status::Suspended;
+}
+
+/**
+    Runs the frames above `depth` until they return or the step limit is reached.
+    They are dropped if a step throws.
+**/
+auto Interpreter::run(size_t depth) -> CompletionRecord
+{
+    CompletionRecord cr;
+    try {
+        if(m_dispatch == Dispatch::Threaded){
+            cr = execute_threaded(depth);
+        }
+        while(m_executionStack.size() > depth && m_stepCount < m_stepLimit){
+            cr = execute_step();
+        }
+    } catch(...) {
+        while(m_executionStack.size() > depth){
+            popContext();
+        }
+        throw;
     }
+    return cr;
+}
+
+/**
+    Host functions are called in place. Script functions get a frame above the
+    current stack, which runs alone until it returns: the caller frames, if any,
+    are left untouched and do not receive the value.
+**/
+var Interpreter::call(var function, var::args_t args)
+{
+    auto* scriptFunction = function.script_function();
+    if(!scriptFunction){
+        return function(args);
+    }
+    auto& callee = static_cast<Function&>(*scriptFunction);
+    if(!owns(callee)){
+        return callee.owner().call(std::move(function), args);
+    }
+
+    auto& params = callee.definition->params;
+    auto locals = callee.locals();
+    for(size_t i = 0; i < params.size(); ++i){
+        locals.insert_or_assign(params[i], args[i]);
+    }
+    var::memory_account::scope scope(m_memory);
+    auto depth = m_executionStack.size();
+    pushFunctionContext(callee, std::move(locals), std::move(function));
+    context().returnsToHost = true;
+
+    // The host waits for the value: the call cannot be suspended
+    auto stepLimit = std::exchange(m_stepLimit, noStepLimit);
+    CompletionRecord cr;
+    try {
+        cr = run(depth);
+    } catch(...) {
+        m_stepLimit = stepLimit;
+        throw;
+    }
+    m_stepLimit = stepLimit;
     return cr.value;
 }
 
@@ -39,18 +229,77 @@ auto Interpreter::execute_step() -> CompletionRecord
 {
     auto& ctx = m_executionStack.top();
     auto saveCurrentNode = ctx.currentNode;
-    CompletionRecord cr = execute_Node(saveCurrentNode);
+    CompletionRecord cr = m_dispatch == Dispatch::Variant
+        ? execute_Node(saveCurrentNode)
+        : execute_Opcode(saveCurrentNode);
+    complete_step(ctx, saveCurrentNode, cr);
+    return cr;
+}
+
+/**
+    Runs until the frames above `depth` return or the step limit is reached, jumping from
+    one handler to the next through a label table indexed by the opcodes resolved in compile().
+**/
+auto Interpreter::execute_threaded(size_t depth) -> CompletionRecord
+{
+    CompletionRecord cr;
+#if INTERPRETER_COMPUTED_GOTO
+    #define INTERPRETER_OPCODE_LABEL(name, call) &&label_##name,
+    static void* const labels[] = {
+        INTERPRETER_OPCODES(INTERPRETER_OPCODE_LABEL)
+    };
+    #undef INTERPRETER_OPCODE_LABEL
+
+    if(m_executionStack.size() <= depth || m_stepCount >= m_stepLimit){
+        return cr;
+    }
+    ExecutionContext* ctx = &context();
+    auto node = ctx->currentNode;
+    goto *labels[static_cast<size_t>(ctx->opcodes[node.index()])];
+
+    #define INTERPRETER_OPCODE_HANDLER(name, call) \
+    label_##name: \
+        cr = call; \
+        complete_step(*ctx, node, cr); \
+        if(m_executionStack.size() <= depth || m_stepCount >= m_stepLimit){ \
+            return cr; \
+        } \
+        ctx = &context(); \
+        node = ctx->currentNode; \
+        goto *labels[static_cast<size_t>(ctx->opcodes[node.index()])];
+    INTERPRETER_OPCODES(INTERPRETER_OPCODE_HANDLER)
+    #undef INTERPRETER_OPCODE_HANDLER
+#else
+    while(m_executionStack.size() > depth && m_stepCount < m_stepLimit){
+        cr = execute_step();
+    }
+    return cr;
+#endif
+}
+
+void Interpreter::complete_step(ExecutionContext& ctx, Parser::ParseNode saveCurrentNode, CompletionRecord& cr)
+{
+    ++m_stepCount;
+    if(var::cycle_collection_due()){
+        var::collect_cycles();
+    }
     if(cr.type == CompletionRecord::Type::Normal){
+        if(ctx.currentNode == ctx.code && ctx.previousNode == ctx.code){
+            // Tail call: the frame now starts the callee, the call node may be gone with its caller
+            return;
+        }
         if(!cr.value.is_undefined()){
-            ctx.calculated.try_emplace(saveCurrentNode, cr.value);
+            // Moved so that a temporary stays the only owner of its payload
+            ctx.calculated.try_emplace(saveCurrentNode, std::move(cr.value));
         }
         ctx.previousNode = saveCurrentNode;
         if(ctx.currentNode == saveCurrentNode){
             ctx.currentNode = saveCurrentNode.parent();
         }
     } else if(cr.type == CompletionRecord::Type::Return) {
-        m_executionStack.pop();
-        if(!m_executionStack.empty()){
+        bool returnsToHost = ctx.returnsToHost;
+        popContext();
+        if(!returnsToHost && !m_executionStack.empty()){
             auto& parentCtx = m_executionStack.top();
             parentCtx.calculated.insert_or_assign(parentCtx.previousNode, cr.value);
         }
@@ -61,7 +310,6 @@ auto Interpreter::execute_step() -> CompletionRecord
     } else if(cr.type == CompletionRecord::Type::Throw) {
         throw unimplemented_error("CompletionRecord::Type::Throw");
     }
-    return cr;
 }
 
 auto Interpreter::execute_Node(Parser::ParseNode node) -> CompletionRecord
@@ -80,7 +328,17 @@ auto Interpreter::execute_Node(Parser::ParseNode node) -> CompletionRecord
         return execute_VarDecl(node);
     }
     assert(std::holds_alternative<Parser::Literal>(nodeVal));
-    return {CompletionRecord::Type::Normal, std::get<Parser::Literal>(*node), {}};
+    return execute_Literal(node);
+}
+
+auto Interpreter::execute_Opcode(Parser::ParseNode node) -> CompletionRecord
+{
+    #define INTERPRETER_OPCODE_CASE(name, call) case Opcode::name: return call;
+    switch(context().opcodes[node.index()]){
+    INTERPRETER_OPCODES(INTERPRETER_OPCODE_CASE)
+    }
+    #undef INTERPRETER_OPCODE_CASE
+    throw std::logic_error("Unreachable code line was reached!");
 }
 
 auto Interpreter::execute_Statement(Parser::ParseNode node) -> CompletionRecord
@@ -114,8 +372,8 @@ auto Interpreter::execute_Operation(Parser::ParseNode node) -> CompletionRecord
         return execute_OPR_Grouping(node);
     case Operation::OPR_JsonObject:
         return execute_OPR_JsonObject(node);
-//    case Operation::OPR_ArrayObject:
-//        return execute_OPR_ArrayObject(node);
+    case Operation::OPR_ArrayObject:
+        return execute_OPR_ArrayObject(node);
     case Operation::OPR_Function:
         return execute_OPR_Function(node);
     case Operation::OPR_MemberAccess:
@@ -147,17 +405,17 @@ auto Interpreter::execute_Operation(Parser::ParseNode node) -> CompletionRecord
 //    case Operation::OPR_Delete:
 //        return execute_OPR_Delete(node);
     case Operation::OPR_Multiplication:
-        return execute_OPR_BinaryOperation<operator* >(node);
+        return execute_OPR_ArithmeticOperation<&var::operator*= >(node);
 //    case Operation::OPR_Exponentiation:
 //        return execute_OPR_Exponentiation(node);
     case Operation::OPR_Division:
-        return execute_OPR_BinaryOperation<operator/ >(node);
+        return execute_OPR_ArithmeticOperation<&var::operator/= >(node);
     case Operation::OPR_Remainder:
-        return execute_OPR_BinaryOperation<operator% >(node);
+        return execute_OPR_ArithmeticOperation<&var::operator%= >(node);
     case Operation::OPR_Addition:
-        return execute_OPR_BinaryOperation<operator+ >(node);
+        return execute_OPR_ArithmeticOperation<&var::operator+= >(node);
     case Operation::OPR_Subtraction:
-        return execute_OPR_BinaryOperation<operator- >(node);
+        return execute_OPR_ArithmeticOperation<&var::operator-= >(node);
 //    case Operation::OPR_BitwiseLeftShift:
 //        return execute_OPR_BinaryOperation<operator<< >(node);
 //    case Operation::OPR_BitwiseRightShift:
@@ -176,14 +434,14 @@ auto Interpreter::execute_Operation(Parser::ParseNode node) -> CompletionRecord
 //        return execute_OPR_In(node);
 //    case Operation::OPR_InstanceOf:
 //        return execute_OPR_InstanceOf(node);
-//    case Operation::OPR_Equality:
-//        return execute_OPR_Equality(node);
-//    case Operation::OPR_Inequality:
-//        return execute_OPR_Inequality(node);
-//    case Operation::OPR_StrictEquality:
-//        return execute_OPR_StrictEquality(node);
-//    case Operation::OPR_StrictInequality:
-//        return execute_OPR_StrictInequality(node);
+    case Operation::OPR_Equality:
+        return execute_OPR_BinaryOperation<&var::loose_equals >(node);
+    case Operation::OPR_Inequality:
+        return execute_OPR_BinaryOperation<&var::differs<&var::loose_equals> >(node);
+    case Operation::OPR_StrictEquality:
+        return execute_OPR_BinaryOperation<&var::strict_equals >(node);
+    case Operation::OPR_StrictInequality:
+        return execute_OPR_BinaryOperation<&var::differs<&var::strict_equals> >(node);
 //    case Operation::OPR_BitwiseAND:
 //        return execute_OPR_BitwiseAND(node);
 //    case Operation::OPR_BitwiseXOR:
@@ -257,6 +515,19 @@ auto Interpreter::execute_VarDecl(Parser::ParseNode node) -> CompletionRecord
     return {CompletionRecord::Type::Normal, variable, {}};
 }
 
+auto Interpreter::execute_Literal(Parser::ParseNode node) -> CompletionRecord
+{
+    return {CompletionRecord::Type::Normal, std::get<Parser::Literal>(*node), {}};
+}
+
+auto Interpreter::execute_Unimplemented(Parser::ParseNode node) -> CompletionRecord
+{
+    if(auto* stm = std::get_if<Parser::Statement>(&*node)){
+        throw unimplemented_error(*stm);
+    }
+    throw unimplemented_error(std::get<Parser::Operation>(*node));
+}
+
 auto Interpreter::execute_STM_TranslationUnit(Parser::ParseNode node) -> CompletionRecord
 {
     if(context().previousNode == node){
@@ -386,7 +657,7 @@ auto Interpreter::execute_OPR_JsonObject(Parser::ParseNode node) -> CompletionRe
 {
     if(context().previousNode == node.parent()){
         if(node.empty()){
-            return CompletionRecord::Normal(std::unordered_map<std::string, var>{});
+            return CompletionRecord::Normal(var::object({}));
         }
         context().currentNode = node.begin();
         return CompletionRecord::Normal();
@@ -396,61 +667,61 @@ auto Interpreter::execute_OPR_JsonObject(Parser::ParseNode node) -> CompletionRe
         context().currentNode = nextNode;
         return CompletionRecord::Normal();
     }
-    std::unordered_map<std::string, var> obj;
+    var::properties_t obj;
     for(auto n = node.begin(); n != nextNode; ++n){
         auto name = context().calculated.extract(n);
         auto value = context().calculated.extract(++n);
-        obj.insert_or_assign(name.mapped().to_string(), std::move(value.mapped()));
+        obj.insert_or_assign(name.mapped().to_key(), std::move(value.mapped()));
     }
-    return CompletionRecord::Normal(std::move(obj));
+    return CompletionRecord::Normal(var::object(std::move(obj)));
+}
+
+auto Interpreter::execute_OPR_ArrayObject(Parser::ParseNode node) -> CompletionRecord
+{
+    if(context().previousNode == node.parent()){
+        if(node.empty()){
+            return CompletionRecord::Normal(var::array());
+        }
+        context().currentNode = node.begin();
+        return CompletionRecord::Normal();
+    }
+    auto nextNode = std::next(context().previousNode);
+    if(nextNode != node.end()){
+        context().currentNode = nextNode;
+        return CompletionRecord::Normal();
+    }
+    std::vector<var> elements;
+    elements.reserve(node.children());
+    for(auto n = node.begin(); n != nextNode; ++n){
+        auto value = context().calculated.extract(n);
+        elements.push_back(value ? std::move(value.mapped()) : var{});
+    }
+    return CompletionRecord::Normal(var::array(std::move(elements)));
 }
 
 auto Interpreter::execute_OPR_Function(Parser::ParseNode node) -> CompletionRecord
 {
-    auto funcName = *node.begin();
-    auto funcCode = std::find_if(std::next(node.begin()), node.end(), [](auto& x){
-        auto* stmPtr = std::get_if<Parser::Statement>(&x);
-        return stmPtr && *stmPtr == Parser::Statement::STM_Block;
-    });
-    std::vector<std::string> funcParams;
-    for(auto it = std::next(node.begin()); it != funcCode; ++it){
-        funcParams.push_back(std::get<Parser::VarDecl>(*it).name);
+    auto& definition = context().compiledCode->functions.at(node);
+
+    std::vector<std::pair<var::string_t const*, var>> captureValues;
+    bool needsScopeChain = false;
+    for(size_t i = 0; i < definition->captureList.size(); ++i){
+        auto& captName = definition->captureList[i];
+        auto& owner = context().environment.property_owner(captName);
+        if(owner.strict_equals(m_globalEnvironment)){
+            continue;
+        }
+        if(owner.strict_equals(context().environment) && definition->constantCaptures[i]){
+            captureValues.emplace_back(&captName, owner[captName]);
+        } else {
+            // Mutable or not yet declared: keep reaching it through the enclosing scope
+            needsScopeChain = true;
+        }
     }
-//    std::vector<std::string> captureList = computeCaptureList(funcCode, std::get<Parser::Literal>(funcName).to_string(), funcParams);
-//    std::unordered_map<std::string, var> captureValues;
-//    for(auto& captName : captureList){
-//        var* captValue = resolveBinding(captName, context().environment);
-//        if(captValue == nullptr){
-//            return {CompletionRecord::Type::Throw, "CaptureError", {}};
-//        }
-//        captureValues.emplace(captName, *captValue);
-//    }
 
-    Parser::ParseTree funcTree{Parser::Statement::STM_TranslationUnit};
-    funcTree.root().append_copy(funcCode);
-
-    return CompletionRecord::Normal(var{[funcTree = std::move(funcTree), funcParams, capturedEnv = context().environment, this](std::vector<var> arguments) mutable{
-        var environment{{}, capturedEnv};
-
-        size_t i = 0;
-        for(auto& param : funcParams){
-            environment[param] = arguments.size() > i ? arguments[i++] : var::undefined;
-        }
-        // make a copy of the code tree
-        m_parseTrees.push_back(std::make_unique<Parser::ParseTree>(funcTree));
-        auto funcCode = m_parseTrees.back()->root();
-        ExecutionContext ctx {
-            Realm{},
-            var{},
-            environment,
-            funcCode,
-            funcCode,
-            funcCode,
-            {}
-        };
-        m_executionStack.push(std::move(ctx));
-        return var::undefined;
-    }});
+    var scope = needsScopeChain ? context().environment : m_globalEnvironment;
+
+    return CompletionRecord::Normal(var{std::make_shared<Function>(*this, definition, std::move(captureValues), std::move(scope))});
 }
 
 auto Interpreter::execute_OPR_MemberAccess(Parser::ParseNode node) -> CompletionRecord
@@ -468,15 +739,19 @@ auto Interpreter::execute_OPR_MemberAccess(Parser::ParseNode node) -> Completion
        && node.parent().begin() == node){
         return CompletionRecord::Normal();
     }
-    auto* memberPtr = resolveMemberAccessNode(node);
-    if(!memberPtr){
+    auto object = context().calculated.extract(node.begin());
+    auto property = context().calculated.extract(std::next(node.begin()));
+    if(object.empty() || property.empty()){
         return {CompletionRecord::Type::Throw, "ReferenceError", {}};
     }
-    context().calculated.erase(node);
-    if(!memberPtr->is_undefined()){
-        context().calculated.try_emplace(node, *memberPtr);
+    var member = object.mapped().get(property.mapped());
+    // The callee of a call keeps its object for `this`
+    if(auto* opr = std::get_if<Parser::Operation>(&*node.parent());
+       opr && *opr == Parser::Operation::OPR_Call
+       && node.parent().begin() == node){
+        context().calculated.insert(std::move(object));
     }
-    return CompletionRecord::Normal(*memberPtr);
+    return CompletionRecord::Normal(std::move(member));
 }
 
 auto Interpreter::execute_OPR_Call(Parser::ParseNode node) -> CompletionRecord
@@ -490,23 +765,88 @@ auto Interpreter::execute_OPR_Call(Parser::ParseNode node) -> CompletionRecord
         context().currentNode = nextNode;
         return CompletionRecord::Normal();
     }
-    std::vector<var> args;
-    args.reserve(node.children() - 1);
-    for(auto childNode = std::next(node.begin()); childNode != nextNode; ++childNode){
-        auto argVarNode = context().calculated.extract(childNode);
-        args.push_back(argVarNode ? argVarNode.mapped() : var::undefined);
+    // The receiver saved by the generic member access must leave calculated whatever the
+    // callee turns out to be, the Variant dispatch runs it even where the opcode is fused
+    var self;
+    auto calleeNode = node.begin();
+    if(auto* opr = std::get_if<Parser::Operation>(&*calleeNode);
+       opr && *opr == Parser::Operation::OPR_MemberAccess){
+        if(auto object = context().calculated.extract(calleeNode.begin())){
+            self = std::move(object.mapped());
+        } else if(context().opcodes[calleeNode.index()] == Opcode::SI_MemberAccessLeaves){
+            self = leafValue(calleeNode.begin());
+        }
     }
-    auto lhs = context().calculated.extract(node.begin());
+
+    auto lhs = context().calculated.extract(calleeNode);
     if(lhs.empty()){
         return {CompletionRecord::Type::Throw, "ReferenceError", {}};
     }
+    if(lhs.mapped().script_function()){
+        return execute_FunctionCall(node, std::move(lhs.mapped()));
+    }
+
+    // Host functions see the arguments in place, only long argument lists go to the heap
+    constexpr size_t inlineArgs = 8;
+    size_t argc = node.children() - 1;
+    std::array<var, inlineArgs> inlineArgv;
+    std::vector<var> heapArgv(argc > inlineArgs ? argc : 0);
+    var* argv = argc > inlineArgs ? heapArgv.data() : inlineArgv.data();
+    for(auto childNode = std::next(node.begin()); childNode != nextNode; ++childNode){
+        if(auto argVarNode = context().calculated.extract(childNode)){
+            *argv = std::move(argVarNode.mapped());
+        }
+        ++argv;
+    }
+    argv -= argc;
     try{
-        return CompletionRecord::Normal(lhs.mapped().operator()(std::move(args)));
+        return CompletionRecord::Normal(lhs.mapped()(var::args_t(argv, argc, &self)));
     }catch(unavailable_operation&){
         return {CompletionRecord::Type::Throw, "TypeError", {}};
     }
 }
 
+/**
+    Sets up the callee frame directly: the arguments go from calculated into the
+    new environment and the Return completion hands the value back to the call node.
+    A call that is the operand of a return statement reuses the frame of the caller,
+    so tail recursion runs in constant space. Functions of another interpreter, shared
+    through the global environment, run on their own interpreter as with call().
+**/
+auto Interpreter::execute_FunctionCall(Parser::ParseNode node, var callee) -> CompletionRecord
+{
+    // Every script function is an Interpreter::Function, not necessarily one of this interpreter
+    auto& function = static_cast<Function&>(*callee.script_function());
+    if(!owns(function)){
+        std::vector<var> args;
+        args.reserve(node.children() - 1);
+        for(auto childNode = std::next(node.begin()); childNode != node.end(); ++childNode){
+            auto argVarNode = context().calculated.extract(childNode);
+            args.push_back(argVarNode ? std::move(argVarNode.mapped()) : var::undefined);
+        }
+        return CompletionRecord::Normal(function.owner().call(std::move(callee), var::args_t(args)));
+    }
+    auto& params = function.definition->params;
+    auto locals = function.locals();
+    auto param = params.begin();
+    for(auto childNode = std::next(node.begin()); childNode != node.end(); ++childNode){
+        auto argVarNode = context().calculated.extract(childNode);
+        if(param != params.end()){
+            locals.insert_or_assign(*param++, argVarNode ? std::move(argVarNode.mapped()) : var::undefined);
+        }
+    }
+    for(; param != params.end(); ++param){
+        locals.insert_or_assign(*param, var::undefined);
+    }
+    if(!context().function.is_undefined()
+       && context().opcodes[node.parent().index()] == Opcode::STM_Return){
+        replaceFunctionContext(function, std::move(locals), std::move(callee));
+        return CompletionRecord::Normal();
+    }
+    pushFunctionContext(function, std::move(locals), std::move(callee));
+    return CompletionRecord::Normal();
+}
+
 auto Interpreter::execute_OPR_LogicalAND(Parser::ParseNode node) -> CompletionRecord
 {
     if(context().previousNode == node.parent()){
@@ -562,7 +902,29 @@ auto Interpreter::execute_OPR_BinaryOperation(Parser::ParseNode node) -> Complet
     }
     auto lhs = context().calculated.extract(node.begin());
     auto rhs = context().calculated.extract(std::next(node.begin()));
-    return CompletionRecord::Normal((*operatorPtr)(lhs ? lhs.mapped() : var{}, rhs ? rhs.mapped() : var{}));
+    return CompletionRecord::Normal(std::invoke(operatorPtr, lhs ? lhs.mapped() : var{}, rhs ? rhs.mapped() : var{}));
+}
+
+/**
+    The left operand is a temporary owned by calculated: the compound operator
+    reuses its payload when nothing else shares it.
+**/
+template<var&(var::*operatorPtr)(var const&)>
+auto Interpreter::execute_OPR_ArithmeticOperation(Parser::ParseNode node) -> CompletionRecord
+{
+    if(context().previousNode == node.parent()){
+        context().currentNode = node.begin();
+        return CompletionRecord::Normal();
+    }
+    if(context().previousNode == node.begin()){
+        context().currentNode = std::next(node.begin());
+        return CompletionRecord::Normal();
+    }
+    auto lhs = context().calculated.extract(node.begin());
+    auto rhs = context().calculated.extract(std::next(node.begin()));
+    var result = lhs ? std::move(lhs.mapped()) : var{};
+    (result.*(operatorPtr))(rhs ? rhs.mapped() : var{});
+    return CompletionRecord::Normal(std::move(result));
 }
 
 template<var&(var::*operatorPtr)(var const&)>
@@ -609,12 +971,10 @@ auto Interpreter::execute_OPR_AssignmentOperation(Parser::ParseNode node) -> Com
     }
     if(auto* operation = std::get_if<Parser::Operation>(&*lhsNode)){
         if(*operation == Parser::Operation::OPR_MemberAccess){
-            auto lshPtr = resolveMemberAccessNode(lhsNode);
-            if(!lshPtr){
-                return {CompletionRecord::Type::Throw, "ReferenceError", {}};
-            }
-            ((*lshPtr).*(operatorPtr))(rhs ? rhs.mapped() : var{});
-            return CompletionRecord::Normal(*lshPtr);
+            return updateMemberAccessNode(lhsNode, [&rhs](var& member){
+                (member.*(operatorPtr))(rhs ? rhs.mapped() : var{});
+                return CompletionRecord::Normal(member);
+            });
         }
         if(*operation == Parser::Operation::OPR_JsonObject){
             throw unimplemented_error("Object-decomposition");
@@ -639,23 +999,24 @@ auto Interpreter::execute_OPR_PostfixAssignmentOperation(Parser::ParseNode node)
         }
     }
 
-    var* lshPtr = nullptr;
+    auto update = [](var& lhs){
+        var oldValue = lhs;
+        (lhs.*(operatorPtr))(0);
+        return CompletionRecord::Normal(oldValue);
+    };
 
     if(auto* varUse = std::get_if<Parser::VarUse>(&*lhsNode)){
-        lshPtr = resolveBinding(varUse->name);
-    } else if(auto operation = std::get_if<Parser::Operation>(&*lhsNode);
-                operation && *operation == Parser::Operation::OPR_MemberAccess){
-        lshPtr = resolveMemberAccessNode(lhsNode);
-    } else {
-        throw std::invalid_argument("Expected VarUse or Operation(OPR_MemberAccess) as LeftHandSideExpression in unary assignment");
+        auto lshPtr = resolveBinding(varUse->name);
+        if(!lshPtr){
+            return {CompletionRecord::Type::Throw, "ReferenceError", {}};
+        }
+        return update(*lshPtr);
     }
-
-    if(!lshPtr){
-        return {CompletionRecord::Type::Throw, "ReferenceError", {}};
+    if(auto operation = std::get_if<Parser::Operation>(&*lhsNode);
+       operation && *operation == Parser::Operation::OPR_MemberAccess){
+        return updateMemberAccessNode(lhsNode, update);
     }
-    var oldValue = *lshPtr;
-    ((*lshPtr).*(operatorPtr))(0);
-    return CompletionRecord::Normal(oldValue);
+    throw std::invalid_argument("Expected VarUse or Operation(OPR_MemberAccess) as LeftHandSideExpression in unary assignment");
 }
 
 template<var&(var::*operatorPtr)()>
@@ -670,26 +1031,78 @@ auto Interpreter::execute_OPR_PrefixAssignmentOperation(Parser::ParseNode node)
         }
     }
 
-    var* lshPtr = nullptr;
+    auto update = [](var& lhs){
+        (lhs.*(operatorPtr))();
+        return CompletionRecord::Normal(lhs);
+    };
 
     if(auto* varUse = std::get_if<Parser::VarUse>(&*lhsNode)){
-        lshPtr = resolveBinding(varUse->name);
-    } else if(auto operation = std::get_if<Parser::Operation>(&*lhsNode);
-                   operation && *operation == Parser::Operation::OPR_MemberAccess){
-        lshPtr = resolveMemberAccessNode(lhsNode);
-    } else {
-        throw std::invalid_argument("Expected VarUse or Operation(OPR_MemberAccess) as LeftHandSideExpression in unary assignment");
+        auto lshPtr = resolveBinding(varUse->name);
+        if(!lshPtr){
+            return {CompletionRecord::Type::Throw, "ReferenceError", {}};
+        }
+        return update(*lshPtr);
+    }
+    if(auto operation = std::get_if<Parser::Operation>(&*lhsNode);
+       operation && *operation == Parser::Operation::OPR_MemberAccess){
+        return updateMemberAccessNode(lhsNode, update);
     }
+    throw std::invalid_argument("Expected VarUse or Operation(OPR_MemberAccess) as LeftHandSideExpression in unary assignment");
+}
+
+template<auto operatorPtr>
+auto Interpreter::execute_SI_BinaryLeaves(Parser::ParseNode node) -> CompletionRecord
+{
+    auto lhsNode = node.begin();
+    return CompletionRecord::Normal(std::invoke(operatorPtr, leafValue(lhsNode), leafValue(std::next(lhsNode))));
+}
 
+auto Interpreter::execute_SI_MemberAccessLeaves(Parser::ParseNode node) -> CompletionRecord
+{
+    auto lhsNode = node.begin();
+    var object = leafValue(lhsNode);
+    auto& property = leafValue(std::next(lhsNode));
+    if(object.is_undefined() || property.is_undefined()){
+        return {CompletionRecord::Type::Throw, "ReferenceError", {}};
+    }
+    return CompletionRecord::Normal(object.get(property));
+}
+
+template<var&(var::*operatorPtr)(var const&)>
+auto Interpreter::execute_SI_AssignmentVarUse(Parser::ParseNode node) -> CompletionRecord
+{
+    auto lhsNode = node.begin();
+    auto rhs = execute_Opcode(std::next(lhsNode));
+    if(rhs.type != CompletionRecord::Type::Normal){
+        return rhs;
+    }
+    auto lshPtr = resolveBinding(std::get<Parser::VarUse>(*lhsNode).name);
     if(!lshPtr){
         return {CompletionRecord::Type::Throw, "ReferenceError", {}};
     }
-    ((*lshPtr).*(operatorPtr))();
+    ((*lshPtr).*(operatorPtr))(rhs.value);
     return CompletionRecord::Normal(*lshPtr);
 }
 
+auto Interpreter::execute_SI_ExpressionSingleStep(Parser::ParseNode node) -> CompletionRecord
+{
+    return execute_Opcode(node.begin());
+}
+
+auto Interpreter::execute_SI_WhileSingleStep(Parser::ParseNode node) -> CompletionRecord
+{
+    auto condition = execute_Opcode(node.begin());
+    if(condition.type != CompletionRecord::Type::Normal){
+        return condition;
+    }
+    if(condition.value.to_bool() == true){
+        context().currentNode = std::next(node.begin());
+    }
+    return CompletionRecord::Normal();
+}
+
 
-auto Interpreter::resolveBinding(std::string const& name, var environment) -> var*
+auto Interpreter::resolveBinding(var::string_t const& name, var environment) -> var*
 {
     if(environment.is_undefined()){
         environment = context().environment;
@@ -697,6 +1110,14 @@ auto Interpreter::resolveBinding(std::string const& name, var environment) -> va
     return &environment[name];
 }
 
+auto Interpreter::leafValue(Parser::ParseNode node) -> var const&
+{
+    if(auto* varUse = std::get_if<Parser::VarUse>(&*node)){
+        return context().environment[varUse->name];
+    }
+    return std::get<Parser::Literal>(*node);
+}
+
 auto Interpreter::resolveMemberAccessNode(Parser::ParseNode node) -> var*
 {
     auto lhs = context().calculated.extract(node.begin());
@@ -710,7 +1131,35 @@ auto Interpreter::resolveMemberAccessNode(Parser::ParseNode node) -> var*
     return &irt.position->second[rhs.mapped()];
 }
 
-constexpr bool Interpreter::isAssignmentOPR(Parser::Operation opr) const
+/**
+    Applies the update to the member designated by the evaluated OPR_MemberAccess node.
+    An array element is updated on a copy then stored back, so packed numbers stay packed
+    and typed arrays write to their buffer.
+**/
+template<class F>
+auto Interpreter::updateMemberAccessNode(Parser::ParseNode node, F update) -> CompletionRecord
+{
+    if(auto object = context().calculated.find(node.begin());
+       object != context().calculated.end() && (object->second.is_array() || object->second.is_typed_array())){
+        var array = std::move(object->second);
+        context().calculated.erase(object);
+        auto property = context().calculated.extract(std::next(node.begin()));
+        if(property.empty()){
+            return {CompletionRecord::Type::Throw, "ReferenceError", {}};
+        }
+        var element = array.get(property.mapped());
+        auto cr = update(element);
+        array.set(property.mapped(), std::move(element));
+        return cr;
+    }
+    auto* memberPtr = resolveMemberAccessNode(node);
+    if(!memberPtr){
+        return {CompletionRecord::Type::Throw, "ReferenceError", {}};
+    }
+    return update(*memberPtr);
+}
+
+constexpr bool Interpreter::isAssignmentOPR(Parser::Operation opr)
 {
     return opr == Parser::Operation::OPR_Assignment
         || opr == Parser::Operation::OPR_AdditionAssignment
@@ -730,6 +1179,395 @@ constexpr bool Interpreter::isAssignmentOPR(Parser::Operation opr) const
         || opr == Parser::Operation::OPR_PrefixDecrement;
 }
 
+auto Interpreter::compileCode(Parser::ParseTree tree, bool optimizations) -> std::shared_ptr<Code>
+{
+    auto code = std::make_shared<Code>(Code{std::move(tree), {}, {}});
+    resolveOpcodes(*code, optimizations);
+    auto root = code->tree.root();
+    compileFunctions(*code, root, root, scopeBindings(root), optimizations);
+    return code;
+}
+
+void Interpreter::resolveOpcodes(Code& code, bool optimizations)
+{
+    code.opcodes.resize(code.tree.size());
+    auto resolve = [&opcodes = code.opcodes](auto& self, Parser::ParseNode node) -> void {
+        opcodes[static_cast<size_t>(node.index())] = resolveOpcode(*node);
+        // The code may run on several threads at once, its literals must not change
+        if(auto* literal = std::get_if<Parser::Literal>(&*node)){
+            literal->flatten();
+        }
+        for(auto child = node.begin(); child != node.end(); ++child){
+            self(self, child);
+        }
+    };
+    resolve(resolve, code.tree.root());
+    if(optimizations){
+        fuseOpcodes(code, code.tree.root());
+    }
+}
+
+namespace
+{
+
+bool isFunctionNode(Parser::ParseResult const& value)
+{
+    auto* opr = std::get_if<Parser::Operation>(&value);
+    return opr && *opr == Parser::Operation::OPR_Function;
+}
+
+} // namespace
+
+/**
+    The nested function expressions are compiled with the code of their enclosing function.
+    `node` is a copy of `source`, where the functions may have been copied without their children.
+**/
+void Interpreter::compileFunctions(Code& code, Parser::ParseNode node, Parser::ParseNode source, Bindings const& bindings, bool optimizations)
+{
+    for(auto child = node.begin(), sourceChild = source.begin(); child != node.end(); ++child, ++sourceChild){
+        if(isFunctionNode(*child)){
+            code.functions.emplace(child, compileFunction(sourceChild, bindings, optimizations));
+        } else {
+            compileFunctions(code, child, sourceChild, bindings, optimizations);
+        }
+    }
+}
+
+/**
+    What every closure created by the function expression at `node` shares.
+    @param bindings scopeBindings() of the code enclosing `node`
+**/
+auto Interpreter::compileFunction(Parser::ParseNode node, Bindings const& bindings, bool optimizations) -> std::shared_ptr<FunctionCode const>
+{
+    auto funcCode = std::find_if(std::next(node.begin()), node.end(), [](auto& x){
+        auto* stmPtr = std::get_if<Parser::Statement>(&x);
+        return stmPtr && *stmPtr == Parser::Statement::STM_Block;
+    });
+    std::vector<var::string_t> funcParams;
+    for(auto it = std::next(node.begin()); it != funcCode; ++it){
+        funcParams.push_back(std::get<Parser::VarDecl>(*it).name);
+    }
+    // The function name is not bound inside its body: it is resolved like any other capture
+    std::vector<var::string_t> captureList = computeCaptureList(funcCode, {}, funcParams);
+    std::vector<bool> constantCaptures;
+    for(auto& captName : captureList){
+        // Constant if it cannot change once the function is created
+        auto binding = bindings.find(captName);
+        constantCaptures.push_back(binding == bindings.end()
+                                   || (!binding->second.assigned
+                                       && !binding->second.declaredInLoop
+                                       && binding->second.declaredUntil <= node.index()));
+    }
+
+    // The nested functions are compiled from the source tree, the tree of this one only keeps their node
+    Parser::ParseTree funcTree{Parser::Statement::STM_TranslationUnit};
+    funcTree.root().append_copy(funcCode, isFunctionNode);
+
+    auto code = std::make_shared<Code>(Code{std::move(funcTree), {}, {}});
+    resolveOpcodes(*code, optimizations);
+    compileFunctions(*code, code->tree.root().begin(), funcCode, scopeBindings(funcCode), optimizations);
+
+    return std::make_shared<FunctionCode const>(FunctionCode{
+        std::move(code),
+        std::move(funcParams),
+        std::move(captureList),
+        std::move(constantCaptures)
+    });
+}
+
+/// Nodes of the tree with their opcodes, and the code of its functions
+size_t Interpreter::memorySize(Code const& code)
+{
+    size_t ret = sizeof(Code)
+               + code.tree.size() * (sizeof(std::pair<int, Parser::ParseResult>) + sizeof(Opcode));
+    for(auto& [node, function] : code.functions){
+        ret += memorySize(*function->code);
+    }
+    return ret;
+}
+
+auto Interpreter::resolveOpcode(Parser::ParseResult const& nodeValue) -> Opcode
+{
+    if(auto* stm = std::get_if<Parser::Statement>(&nodeValue)){
+        #define INTERPRETER_STATEMENT_CASE(name, call) case Parser::Statement::name: return Opcode::name;
+        switch(*stm){
+        INTERPRETER_STATEMENTS(INTERPRETER_STATEMENT_CASE)
+        default:
+            return Opcode::Unimplemented;
+        }
+        #undef INTERPRETER_STATEMENT_CASE
+    }
+    if(auto* opr = std::get_if<Parser::Operation>(&nodeValue)){
+        #define INTERPRETER_OPERATION_CASE(name, call) case Parser::Operation::name: return Opcode::name;
+        switch(*opr){
+        INTERPRETER_OPERATIONS(INTERPRETER_OPERATION_CASE)
+        default:
+            return Opcode::Unimplemented;
+        }
+        #undef INTERPRETER_OPERATION_CASE
+    }
+    if(std::holds_alternative<Parser::VarUse>(nodeValue)){
+        return Opcode::VarUse;
+    }
+    if(std::holds_alternative<Parser::VarDecl>(nodeValue)){
+        return Opcode::VarDecl;
+    }
+    return Opcode::Literal;
+}
+
+/**
+    Replaces the opcodes of recognized node patterns by superinstructions,
+    children first so that patterns can be nested.
+**/
+void Interpreter::fuseOpcodes(Code& code, Parser::ParseNode node)
+{
+    for(auto child = node.begin(); child != node.end(); ++child){
+        fuseOpcodes(code, child);
+    }
+
+    auto isLeaf = [](Parser::ParseNode n){
+        return std::holds_alternative<Parser::VarUse>(*n) || std::holds_alternative<Parser::Literal>(*n);
+    };
+    auto& opcode = code.opcodes[static_cast<size_t>(node.index())];
+
+    switch(opcode){
+    case Opcode::OPR_Multiplication:
+    case Opcode::OPR_Division:
+    case Opcode::OPR_Remainder:
+    case Opcode::OPR_Addition:
+    case Opcode::OPR_Subtraction:
+    case Opcode::OPR_LessThan:
+    case Opcode::OPR_LessThanOrEqual:
+    case Opcode::OPR_GreaterThan:
+    case Opcode::OPR_GreaterThanOrEqual:
+    case Opcode::OPR_Equality:
+    case Opcode::OPR_Inequality:
+    case Opcode::OPR_StrictEquality:
+    case Opcode::OPR_StrictInequality:
+        if(isLeaf(node.begin()) && isLeaf(std::next(node.begin()))){
+            static constexpr std::pair<Opcode, Opcode> leavesOpcodes[] = {
+                {Opcode::OPR_Multiplication,     Opcode::SI_MultiplicationLeaves},
+                {Opcode::OPR_Division,           Opcode::SI_DivisionLeaves},
+                {Opcode::OPR_Remainder,          Opcode::SI_RemainderLeaves},
+                {Opcode::OPR_Addition,           Opcode::SI_AdditionLeaves},
+                {Opcode::OPR_Subtraction,        Opcode::SI_SubtractionLeaves},
+                {Opcode::OPR_LessThan,           Opcode::SI_LessThanLeaves},
+                {Opcode::OPR_LessThanOrEqual,    Opcode::SI_LessThanOrEqualLeaves},
+                {Opcode::OPR_GreaterThan,        Opcode::SI_GreaterThanLeaves},
+                {Opcode::OPR_GreaterThanOrEqual, Opcode::SI_GreaterThanOrEqualLeaves},
+                {Opcode::OPR_Equality,           Opcode::SI_EqualityLeaves},
+                {Opcode::OPR_Inequality,         Opcode::SI_InequalityLeaves},
+                {Opcode::OPR_StrictEquality,     Opcode::SI_StrictEqualityLeaves},
+                {Opcode::OPR_StrictInequality,   Opcode::SI_StrictInequalityLeaves},
+            };
+            opcode = std::find_if(std::begin(leavesOpcodes), std::end(leavesOpcodes), [opcode](auto& p){
+                return p.first == opcode;
+            })->second;
+        }
+        break;
+    case Opcode::OPR_MemberAccess:
+        if(isLeaf(node.begin()) && isLeaf(std::next(node.begin()))){
+            // Assignment targets keep the generic handler, which yields a reference
+            auto* parentOpr = node.is_root() ? nullptr : std::get_if<Parser::Operation>(&*node.parent());
+            if(!(parentOpr && isAssignmentOPR(*parentOpr) && node.parent().begin() == node)){
+                opcode = Opcode::SI_MemberAccessLeaves;
+            }
+        }
+        break;
+    case Opcode::OPR_Assignment:
+    case Opcode::OPR_AdditionAssignment:
+    case Opcode::OPR_SubtractAssignment:
+    case Opcode::OPR_MultiplicationAssignment:
+    case Opcode::OPR_DivisionAssignment:
+    case Opcode::OPR_RemainderAssignment:
+        if(std::holds_alternative<Parser::VarUse>(*node.begin()) && isSingleStep(code, std::next(node.begin()))){
+            static constexpr std::pair<Opcode, Opcode> varUseOpcodes[] = {
+                {Opcode::OPR_Assignment,               Opcode::SI_AssignmentVarUse},
+                {Opcode::OPR_AdditionAssignment,       Opcode::SI_AdditionAssignmentVarUse},
+                {Opcode::OPR_SubtractAssignment,       Opcode::SI_SubtractAssignmentVarUse},
+                {Opcode::OPR_MultiplicationAssignment, Opcode::SI_MultiplicationAssignmentVarUse},
+                {Opcode::OPR_DivisionAssignment,       Opcode::SI_DivisionAssignmentVarUse},
+                {Opcode::OPR_RemainderAssignment,      Opcode::SI_RemainderAssignmentVarUse},
+            };
+            opcode = std::find_if(std::begin(varUseOpcodes), std::end(varUseOpcodes), [opcode](auto& p){
+                return p.first == opcode;
+            })->second;
+        }
+        break;
+    case Opcode::STM_Expression:
+        if(node.children() == 1 && isLoopBody(node)){
+            // Nothing reads a loop body statement value: i++ can update i in place like ++i
+            auto& childOpcode = code.opcodes[static_cast<size_t>(node.begin().index())];
+            if(std::holds_alternative<Parser::VarUse>(*node.begin().begin())){
+                if(childOpcode == Opcode::OPR_PostfixIncrement){
+                    childOpcode = Opcode::OPR_PrefixIncrement;
+                } else if(childOpcode == Opcode::OPR_PostfixDecrement){
+                    childOpcode = Opcode::OPR_PrefixDecrement;
+                }
+            }
+        }
+        if(node.children() == 1 && isSingleStep(code, node.begin())){
+            opcode = Opcode::SI_ExpressionSingleStep;
+        }
+        break;
+    case Opcode::STM_While:
+        if(isSingleStep(code, node.begin())){
+            opcode = Opcode::SI_WhileSingleStep;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+    Gathers in a single pass how `code` declares and assigns each name, the nested functions included.
+    A declaration counts as in a loop if it is inside the body of a while or do-while statement of `code`.
+**/
+auto Interpreter::scopeBindings(Parser::ParseNode code) -> Bindings
+{
+    Bindings bindings;
+    auto scan = [&bindings](auto& self, Parser::ParseNode node, bool inLoop) -> void {
+        auto* stm = std::get_if<Parser::Statement>(&*node);
+        auto* opr = std::get_if<Parser::Operation>(&*node);
+        bool const assigns = opr && (isAssignmentOPR(*opr)
+                                     || *opr == Parser::Operation::OPR_PostfixIncrement
+                                     || *opr == Parser::Operation::OPR_PostfixDecrement
+                                     || *opr == Parser::Operation::OPR_PrefixIncrement
+                                     || *opr == Parser::Operation::OPR_PrefixDecrement);
+        for(auto child = node.begin(); child != node.end(); ++child){
+            bool const childInLoop = inLoop
+                || (stm && *stm == Parser::Statement::STM_While && child != node.begin())
+                || (stm && *stm == Parser::Statement::STM_DoWhile && child == node.begin());
+            if(auto* varDecl = std::get_if<Parser::VarDecl>(&*child)){
+                auto& binding = bindings[varDecl->name];
+                binding.declaredUntil = std::max(binding.declaredUntil, child.end().index());
+                binding.declaredInLoop = binding.declaredInLoop || childInLoop;
+            } else if(auto* varUse = std::get_if<Parser::VarUse>(&*child); varUse && assigns && child == node.begin()){
+                bindings[varUse->name].assigned = true;
+            }
+            self(self, child, childInLoop);
+        }
+    };
+    scan(scan, code, false);
+    return bindings;
+}
+
+/**
+    @return true if the node is inside the body of a while or do-while statement
+**/
+bool Interpreter::isLoopBody(Parser::ParseNode node)
+{
+    while(!node.is_root()){
+        auto parent = node.parent();
+        if(auto* stm = std::get_if<Parser::Statement>(&*parent)){
+            if(*stm == Parser::Statement::STM_While && node != parent.begin()){
+                return true;
+            }
+            if(*stm == Parser::Statement::STM_DoWhile && node == parent.begin()){
+                return true;
+            }
+        }
+        node = parent;
+    }
+    return false;
+}
+
+/**
+    @return true if the node computes its value the first time it is visited,
+    without descending into its children nor reading the calculated values
+**/
+bool Interpreter::isSingleStep(Code const& code, Parser::ParseNode node)
+{
+    switch(code.opcodes[static_cast<size_t>(node.index())]){
+    case Opcode::Literal:
+    case Opcode::VarUse:
+    case Opcode::SI_MultiplicationLeaves:
+    case Opcode::SI_DivisionLeaves:
+    case Opcode::SI_RemainderLeaves:
+    case Opcode::SI_AdditionLeaves:
+    case Opcode::SI_SubtractionLeaves:
+    case Opcode::SI_LessThanLeaves:
+    case Opcode::SI_LessThanOrEqualLeaves:
+    case Opcode::SI_GreaterThanLeaves:
+    case Opcode::SI_GreaterThanOrEqualLeaves:
+    case Opcode::SI_EqualityLeaves:
+    case Opcode::SI_InequalityLeaves:
+    case Opcode::SI_StrictEqualityLeaves:
+    case Opcode::SI_StrictInequalityLeaves:
+    case Opcode::SI_MemberAccessLeaves:
+    case Opcode::SI_AssignmentVarUse:
+    case Opcode::SI_AdditionAssignmentVarUse:
+    case Opcode::SI_SubtractAssignmentVarUse:
+    case Opcode::SI_MultiplicationAssignmentVarUse:
+    case Opcode::SI_DivisionAssignmentVarUse:
+    case Opcode::SI_RemainderAssignmentVarUse:
+        return true;
+    case Opcode::OPR_PostfixIncrement:
+    case Opcode::OPR_PostfixDecrement:
+    case Opcode::OPR_PrefixIncrement:
+    case Opcode::OPR_PrefixDecrement:
+        return std::holds_alternative<Parser::VarUse>(*node.begin());
+    default:
+        return false;
+    }
+}
+
+void Interpreter::pushContext(Code& code, var environment, var function)
+{
+    auto root = code.tree.root();
+    ExecutionContext ctx {
+        Realm{},
+        std::move(function),
+        std::move(environment),
+        code.opcodes.data(),
+        &code,
+        root,
+        root,
+        root,
+        {}
+    };
+    if(!m_calculatedPool.empty()){
+        ctx.calculated = std::move(m_calculatedPool.back());
+        m_calculatedPool.pop_back();
+    }
+    m_executionStack.push(std::move(ctx));
+}
+
+/**
+    @param locals the own bindings of the call: captures and arguments
+**/
+void Interpreter::pushFunctionContext(Function& function, var::properties_t locals, var callee)
+{
+    pushContext(*function.definition->code, var::object(std::move(locals), function.scope), std::move(callee));
+}
+
+/**
+    Restarts the current frame on the callee, which returns where the current function would have.
+**/
+void Interpreter::replaceFunctionContext(Function& function, var::properties_t locals, var callee)
+{
+    auto& ctx = context();
+    auto& code = *function.definition->code;
+    auto root = code.tree.root();
+    ctx.calculated.clear();
+    ctx.environment = var::object(std::move(locals), function.scope);
+    ctx.function = std::move(callee);
+    ctx.opcodes = code.opcodes.data();
+    ctx.compiledCode = &code;
+    ctx.code = root;
+    ctx.currentNode = root;
+    ctx.previousNode = root;
+}
+
+void Interpreter::popContext()
+{
+    auto& calculated = context().calculated;
+    calculated.clear();
+    m_calculatedPool.push_back(std::move(calculated));
+    m_executionStack.pop();
+}
+
 var Interpreter::movePreviousCalculated(Parser::ParseNode node, bool replaceIfAlreadyExists)
 {
     auto valueNodeHandle = context().calculated.extract(context().previousNode);
@@ -744,14 +1582,14 @@ var Interpreter::movePreviousCalculated(Parser::ParseNode node, bool replaceIfAl
     return irt.position->second;
 }
 
-auto Interpreter::computeCaptureList(Parser::ParseNode funcCode, std::string const& funcName, std::vector<std::string> funcParams) const -> std::vector<std::string>
+auto Interpreter::computeCaptureList(Parser::ParseNode funcCode, var::string_t const& funcName, std::vector<var::string_t> funcParams) -> std::vector<var::string_t>
 {
-    std::vector<std::string> captureList;
-    std::vector<std::vector<std::string>> knownNames;
+    std::vector<var::string_t> captureList;
+    std::vector<std::vector<var::string_t>> knownNames;
     funcParams.push_back(funcName);
     knownNames.push_back(funcParams);
 
-    auto isKnown = [&captureList, &knownNames](std::string const& name){
+    auto isKnown = [&captureList, &knownNames](var::string_t const& name){
         if(std::find(std::begin(captureList), std::end(captureList), name) != std::end(captureList)){
             return true;
         }
@@ -764,8 +1602,8 @@ auto Interpreter::computeCaptureList(Parser::ParseNode funcCode, std::string con
     };
 
     auto computeFuncKnownList = [](Parser::ParseNode funcNode){
-        std::vector<std::string> knownNames;
-        knownNames.push_back(std::get<Parser::Literal>(*funcNode.begin()).to_string());
+        std::vector<var::string_t> knownNames;
+        knownNames.push_back(std::get<Parser::Literal>(*funcNode.begin()).to_key());
         auto funcCode = funcNode.last_child();
         for(auto it = std::next(funcNode.begin()); it != funcCode; ++it){
             knownNames.push_back(std::get<Parser::VarDecl>(*it).name);
@@ -820,12 +1658,6 @@ struct ParseNodeRobber {
 };
 template struct Rob<ParseNodeRobber, &Parser::ParseNode::m_tree>;
 
-struct ParseNodeIndexRobber {
-    typedef std::vector<std::pair<int, Parser::ParseResult>>::difference_type Parser::ParseNode::*type;
-    friend type get(ParseNodeIndexRobber);
-};
-template struct Rob<ParseNodeIndexRobber, &Parser::ParseNode::m_index>;
-
 
 template<class T>
 struct StackInspector: public std::stack<T>
@@ -840,7 +1672,7 @@ static StackInspector<T> const& inspect(std::stack<T> const& s){ return *static_
 std::ostream& operator<<(std::ostream& out, Interpreter const& interpreter) {
     out << "=== ParseTrees ===\n";
     for(auto& pt : interpreter.m_parseTrees){
-        out << *pt;
+        out << pt->tree;
     }
     out << "=== Stack ===\n";
     for(auto& exec : inspect(interpreter.m_executionStack).c){
@@ -856,7 +1688,7 @@ std::ostream& operator<<(std::ostream& out, Interpreter const& interpreter) {
         }
         out << "calculated: {";
         for(auto& [parseNode, value] : exec.calculated){
-            out << parseNode.*get(ParseNodeIndexRobber()) << ":" << value << ",";
+            out << parseNode.index() << ":" << value << ",";
         }
         out << "}\n";
         out << "}\n";
@@ -1,18 +1,201 @@
 #pragma once
 
 #include "Parser.h"
+#include "Optimizer.h"
+
+#include <array>
+#include <chrono>
+#include <limits>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define INTERPRETER_COMPUTED_GOTO 1
+#else
+#define INTERPRETER_COMPUTED_GOTO 0
+#endif
+
+/// X(Opcode, handler call) for every node kind the interpreter can execute
+#define INTERPRETER_STATEMENTS(X) \
+    X(STM_TranslationUnit,          execute_STM_TranslationUnit(node)) \
+    X(STM_Expression,               execute_STM_Expression(node)) \
+    X(STM_Block,                    execute_STM_Block(node)) \
+    X(STM_If,                       execute_STM_If(node)) \
+    X(STM_While,                    execute_STM_While(node)) \
+    X(STM_DoWhile,                  execute_STM_DoWhile(node)) \
+    X(STM_Return,                   execute_STM_Return(node))
+
+#define INTERPRETER_OPERATIONS(X) \
+    X(OPR_Grouping,                 execute_OPR_Grouping(node)) \
+    X(OPR_JsonObject,               execute_OPR_JsonObject(node)) \
+    X(OPR_ArrayObject,              execute_OPR_ArrayObject(node)) \
+    X(OPR_Function,                 execute_OPR_Function(node)) \
+    X(OPR_MemberAccess,             execute_OPR_MemberAccess(node)) \
+    X(OPR_Call,                     execute_OPR_Call(node)) \
+    X(OPR_PostfixIncrement,         execute_OPR_PostfixAssignmentOperation<&var::operator++ >(node)) \
+    X(OPR_PostfixDecrement,         execute_OPR_PostfixAssignmentOperation<&var::operator-- >(node)) \
+    X(OPR_PrefixIncrement,          execute_OPR_PrefixAssignmentOperation<&var::operator++ >(node)) \
+    X(OPR_PrefixDecrement,          execute_OPR_PrefixAssignmentOperation<&var::operator-- >(node)) \
+    X(OPR_Multiplication,           execute_OPR_ArithmeticOperation<&var::operator*= >(node)) \
+    X(OPR_Division,                 execute_OPR_ArithmeticOperation<&var::operator/= >(node)) \
+    X(OPR_Remainder,                execute_OPR_ArithmeticOperation<&var::operator%= >(node)) \
+    X(OPR_Addition,                 execute_OPR_ArithmeticOperation<&var::operator+= >(node)) \
+    X(OPR_Subtraction,              execute_OPR_ArithmeticOperation<&var::operator-= >(node)) \
+    X(OPR_LessThan,                 execute_OPR_BinaryOperation<operator< >(node)) \
+    X(OPR_LessThanOrEqual,          execute_OPR_BinaryOperation<operator<= >(node)) \
+    X(OPR_GreaterThan,              execute_OPR_BinaryOperation<operator> >(node)) \
+    X(OPR_GreaterThanOrEqual,       execute_OPR_BinaryOperation<operator>= >(node)) \
+    X(OPR_Equality,                 execute_OPR_BinaryOperation<&var::loose_equals >(node)) \
+    X(OPR_Inequality,               execute_OPR_BinaryOperation<&var::differs<&var::loose_equals> >(node)) \
+    X(OPR_StrictEquality,           execute_OPR_BinaryOperation<&var::strict_equals >(node)) \
+    X(OPR_StrictInequality,         execute_OPR_BinaryOperation<&var::differs<&var::strict_equals> >(node)) \
+    X(OPR_LogicalAND,               execute_OPR_LogicalAND(node)) \
+    X(OPR_LogicalOR,                execute_OPR_LogicalOR(node)) \
+    X(OPR_Assignment,               execute_OPR_AssignmentOperation(node)) \
+    X(OPR_AdditionAssignment,       execute_OPR_AssignmentOperation<&var::operator+= >(node)) \
+    X(OPR_SubtractAssignment,       execute_OPR_AssignmentOperation<&var::operator-= >(node)) \
+    X(OPR_MultiplicationAssignment, execute_OPR_AssignmentOperation<&var::operator*= >(node)) \
+    X(OPR_DivisionAssignment,       execute_OPR_AssignmentOperation<&var::operator/= >(node)) \
+    X(OPR_RemainderAssignment,      execute_OPR_AssignmentOperation<&var::operator%= >(node))
+
+#define INTERPRETER_NODES(X) \
+    X(VarUse,                       execute_VarUse(node)) \
+    X(VarDecl,                      execute_VarDecl(node)) \
+    X(Literal,                      execute_Literal(node)) \
+    X(Unimplemented,                execute_Unimplemented(node))
+
+/// Superinstructions: common node patterns executed in a single step
+#define INTERPRETER_SUPERINSTRUCTIONS(X) \
+    X(SI_MultiplicationLeaves,           execute_SI_BinaryLeaves<operator* >(node)) \
+    X(SI_DivisionLeaves,                 execute_SI_BinaryLeaves<operator/ >(node)) \
+    X(SI_RemainderLeaves,                execute_SI_BinaryLeaves<operator% >(node)) \
+    X(SI_AdditionLeaves,                 execute_SI_BinaryLeaves<operator+ >(node)) \
+    X(SI_SubtractionLeaves,              execute_SI_BinaryLeaves<operator- >(node)) \
+    X(SI_LessThanLeaves,                 execute_SI_BinaryLeaves<operator< >(node)) \
+    X(SI_LessThanOrEqualLeaves,          execute_SI_BinaryLeaves<operator<= >(node)) \
+    X(SI_GreaterThanLeaves,              execute_SI_BinaryLeaves<operator> >(node)) \
+    X(SI_GreaterThanOrEqualLeaves,       execute_SI_BinaryLeaves<operator>= >(node)) \
+    X(SI_EqualityLeaves,                 execute_SI_BinaryLeaves<&var::loose_equals >(node)) \
+    X(SI_InequalityLeaves,               execute_SI_BinaryLeaves<&var::differs<&var::loose_equals> >(node)) \
+    X(SI_StrictEqualityLeaves,           execute_SI_BinaryLeaves<&var::strict_equals >(node)) \
+    X(SI_StrictInequalityLeaves,         execute_SI_BinaryLeaves<&var::differs<&var::strict_equals> >(node)) \
+    X(SI_MemberAccessLeaves,             execute_SI_MemberAccessLeaves(node)) \
+    X(SI_AssignmentVarUse,               execute_SI_AssignmentVarUse(node)) \
+    X(SI_AdditionAssignmentVarUse,       execute_SI_AssignmentVarUse<&var::operator+= >(node)) \
+    X(SI_SubtractAssignmentVarUse,       execute_SI_AssignmentVarUse<&var::operator-= >(node)) \
+    X(SI_MultiplicationAssignmentVarUse, execute_SI_AssignmentVarUse<&var::operator*= >(node)) \
+    X(SI_DivisionAssignmentVarUse,       execute_SI_AssignmentVarUse<&var::operator/= >(node)) \
+    X(SI_RemainderAssignmentVarUse,      execute_SI_AssignmentVarUse<&var::operator%= >(node)) \
+    X(SI_ExpressionSingleStep,           execute_SI_ExpressionSingleStep(node)) \
+    X(SI_WhileSingleStep,                execute_SI_WhileSingleStep(node))
+
+#define INTERPRETER_OPCODES(X) \
+    INTERPRETER_STATEMENTS(X) \
+    INTERPRETER_OPERATIONS(X) \
+    INTERPRETER_NODES(X) \
+    INTERPRETER_SUPERINSTRUCTIONS(X)
 
 class Interpreter
 {
+    struct Code;
+
 public:
+    /// How execute() finds the handler of the current node
+    enum class Dispatch
+    {
+        Variant,  ///< std::variant alternative then Statement/Operation switch, resolved at each step
+        Switch,   ///< switch over the opcode resolved when the code was fed
+        Threaded, ///< computed goto over the resolved opcode (Switch where unsupported)
+    };
+
     Interpreter();
+    class Snapshot;
+    /// Starts from the global environment and the code of the snapshot, without running the scripts again
+    explicit Interpreter(Snapshot const& snapshot);
+    ~Interpreter();
+    Interpreter(Interpreter const&) = delete;
+    Interpreter& operator=(Interpreter const&) = delete;
 
     var& globalEnvironment(){ return m_globalEnvironment; }
+    bool& optimizations(){ return m_optimizations; }
+    Dispatch& dispatch(){ return m_dispatch; }
+    /**
+        Memory of the values created while the interpreter runs and of its parse trees.
+        Past its limit, feed(), execute() and call() throw memory_limit_error and the
+        frames they were running are dropped: the interpreter can be fed again.
+    **/
+    var::memory_account& memory(){ return *m_memory; }
+    unsigned long long stepCount() const { return m_stepCount; }
+    /// Frames on the execution stack, the global code included
+    size_t stackDepth() const { return m_executionStack.size(); }
+
+    /**
+        Compiled code, the function expressions included. It is never modified afterwards:
+        interpreters on any thread may run it at the same time, what they change stays in their frames.
+    **/
+    class Script
+    {
+    public:
+        Script() = default;
+        explicit operator bool() const { return static_cast<bool>(m_code); }
 
+    private:
+        friend class Interpreter;
+        explicit Script(std::shared_ptr<Code> code): m_code(std::move(code)){}
+
+        std::shared_ptr<Code> m_code;
+    };
+    static Script compile(Parser::ParseTree tree, bool optimizations = true);
+
+    /**
+        Frozen copy of the global environment and of the code fed so far. The interpreters
+        started from it copy its objects, arrays and script functions, and share the rest,
+        the compiled code included. Any thread may start interpreters from the same snapshot,
+        which needs VAR_ATOMIC_REFCOUNT: they share the reference counts of these values.
+    **/
+    class Snapshot
+    {
+    public:
+        Snapshot() = default;
+        explicit operator bool() const { return static_cast<bool>(m_interpreter); }
+
+    private:
+        friend class Interpreter;
+        explicit Snapshot(std::shared_ptr<Interpreter const> interpreter): m_interpreter(std::move(interpreter)){}
+
+        std::shared_ptr<Interpreter const> m_interpreter;
+    };
+    /// The stack must be empty, the interpreter goes on unchanged
+    Snapshot snapshot() const;
+
+    /// Compiles the tree for this interpreter alone, its memory is charged to memory()
     void feed(Parser::ParseTree tree);
+    /// Shares a script compiled beforehand
+    void feed(Script script);
 
     var execute();
 
+    enum class Status
+    {
+        Completed, ///< the stack is empty, completionValue() holds the value of the last script
+        Suspended, ///< frames are left, any execute function resumes them
+    };
+    /**
+        Runs at most `maxSteps` steps, so that the thread can be given back between slices.
+        A call() made meanwhile by a host function runs to completion in the current slice.
+    **/
+    Status execute_for(unsigned long long maxSteps);
+    /// Runs until the deadline, which is checked between slices of steps
+    Status execute_until(std::chrono::steady_clock::time_point deadline);
+    var const& completionValue() const { return m_completionValue; }
+
+    /// Runs the function to completion on top of the current stack and returns its value
+    var call(var function, var::args_t args);
+    template<class...Args>
+    var call(var function, Args&&...args)
+    {
+        std::array<var, sizeof...(Args)> argv{var(std::forward<Args>(args))...};
+        return call(std::move(function), var::args_t(argv.data(), argv.size()));
+    }
+
     class unimplemented_error: public std::runtime_error
     {
     public:
@@ -47,24 +230,84 @@ private:
 
     };
 
+    #define INTERPRETER_OPCODE_ENUM(name, call) name,
+    enum class Opcode : unsigned char
+    {
+        INTERPRETER_OPCODES(INTERPRETER_OPCODE_ENUM)
+    };
+    #undef INTERPRETER_OPCODE_ENUM
+
+    struct FunctionCode;
+
+    /// Immutable once compiled
+    struct Code
+    {
+        Parser::ParseTree tree;
+        std::vector<Opcode> opcodes;
+        /// Function expressions of the tree, outside of the nested ones
+        std::unordered_map<Parser::ParseNode, std::shared_ptr<FunctionCode const>, Parser::ParseNode::Hash> functions;
+    };
+
+    /// What the closures created by a function expression share
+    struct FunctionCode
+    {
+        std::shared_ptr<Code> code;
+        std::vector<var::string_t> params;
+        std::vector<var::string_t> captureList;
+        /// Whether each name of captureList is a constant Binding of the enclosing scope
+        std::vector<bool> constantCaptures;
+    };
+
+    /// Script function: every call runs the same Code on a new frame
+    struct Function final: ScriptFunction, std::enable_shared_from_this<Function>
+    {
+        Function(Interpreter& creator, std::shared_ptr<FunctionCode const> functionCode,
+                 std::vector<std::pair<var::string_t const*, var>> captureValues, var enclosingScope);
+
+        var operator()(var::args_t args) override;
+        void for_each_reference(std::function<void(var const&)> const& visit) const override;
+        size_t memory_size() const override;
+
+        /// Own bindings of a new call, before the arguments
+        var::properties_t locals() const;
+        /// The interpreter running the calls, std::logic_error once it is destroyed
+        Interpreter& owner() const;
+
+        /// The function may outlive its interpreter, given to the host or to another interpreter
+        std::weak_ptr<Interpreter*> interpreter;
+        std::shared_ptr<FunctionCode const> definition;
+        /// Captured values, named after definition->captureList
+        std::vector<std::pair<var::string_t const*, var>> captures;
+        var scope;
+    };
+
     struct ExecutionContext
     {
         Realm realm;
         var function;
         var environment;
+        Opcode const* opcodes;
+        Code* compiledCode;
         Parser::ParseNode code;
         Parser::ParseNode currentNode;
         Parser::ParseNode previousNode;
         std::unordered_map<Parser::ParseNode, var, Parser::ParseNode::Hash> calculated;
+        bool returnsToHost = false;
     };
 
+    auto run(size_t depth) -> CompletionRecord;
     auto execute_step() -> CompletionRecord;
+    auto execute_threaded(size_t depth = 0) -> CompletionRecord;
+    void complete_step(ExecutionContext& ctx, Parser::ParseNode node, CompletionRecord& cr);
 
     auto execute_Node                           (Parser::ParseNode node) -> CompletionRecord;
+    auto execute_Opcode                         (Parser::ParseNode node) -> CompletionRecord;
     auto execute_Statement                      (Parser::ParseNode node) -> CompletionRecord;
     auto execute_Operation                      (Parser::ParseNode node) -> CompletionRecord;
     auto execute_VarUse                         (Parser::ParseNode node) -> CompletionRecord;
     auto execute_VarDecl                        (Parser::ParseNode node) -> CompletionRecord;
+    auto execute_Literal                        (Parser::ParseNode node) -> CompletionRecord;
+    auto execute_Unimplemented                  (Parser::ParseNode node) -> CompletionRecord;
 
     auto execute_STM_TranslationUnit            (Parser::ParseNode node) -> CompletionRecord;
     auto execute_STM_Expression                 (Parser::ParseNode node) -> CompletionRecord;
@@ -76,13 +319,17 @@ private:
 
     auto execute_OPR_Grouping                   (Parser::ParseNode node) -> CompletionRecord;
     auto execute_OPR_JsonObject                 (Parser::ParseNode node) -> CompletionRecord;
+    auto execute_OPR_ArrayObject                (Parser::ParseNode node) -> CompletionRecord;
     auto execute_OPR_Function                   (Parser::ParseNode node) -> CompletionRecord;
     auto execute_OPR_MemberAccess               (Parser::ParseNode node) -> CompletionRecord;
     auto execute_OPR_Call                       (Parser::ParseNode node) -> CompletionRecord;
+    auto execute_FunctionCall                   (Parser::ParseNode node, var callee) -> CompletionRecord;
     auto execute_OPR_LogicalAND                 (Parser::ParseNode node) -> CompletionRecord;
     auto execute_OPR_LogicalOR                  (Parser::ParseNode node) -> CompletionRecord;
     template<auto operatorPtr>
     auto execute_OPR_BinaryOperation            (Parser::ParseNode node) -> CompletionRecord;
+    template<var&(var::*operatorPtr)(var const&)>
+    auto execute_OPR_ArithmeticOperation        (Parser::ParseNode node) -> CompletionRecord;
     template<var&(var::*operatorPtr)(var const&) = &var::operator= >
     auto execute_OPR_AssignmentOperation        (Parser::ParseNode node) -> CompletionRecord;
     template<var(var::*operatorPtr)(int) = &var::operator++ >
@@ -90,20 +337,80 @@ private:
     template<var&(var::*operatorPtr)() = &var::operator++ >
     auto execute_OPR_PrefixAssignmentOperation  (Parser::ParseNode node) -> CompletionRecord;
 
-    auto resolveBinding(std::string const& name, var environment = {}) -> var*;
+    template<auto operatorPtr>
+    auto execute_SI_BinaryLeaves                (Parser::ParseNode node) -> CompletionRecord;
+    auto execute_SI_MemberAccessLeaves          (Parser::ParseNode node) -> CompletionRecord;
+    template<var&(var::*operatorPtr)(var const&) = &var::operator= >
+    auto execute_SI_AssignmentVarUse            (Parser::ParseNode node) -> CompletionRecord;
+    auto execute_SI_ExpressionSingleStep        (Parser::ParseNode node) -> CompletionRecord;
+    auto execute_SI_WhileSingleStep             (Parser::ParseNode node) -> CompletionRecord;
+
+    auto resolveBinding(var::string_t const& name, var environment = {}) -> var*;
+    auto leafValue(Parser::ParseNode node) -> var const&;
     auto resolveMemberAccessNode(Parser::ParseNode node) -> var*;
-    constexpr bool isAssignmentOPR(Parser::Operation opr) const;
+    template<class F>
+    auto updateMemberAccessNode(Parser::ParseNode node, F update) -> CompletionRecord;
+    static constexpr bool isAssignmentOPR(Parser::Operation opr);
 
     var movePreviousCalculated(Parser::ParseNode node, bool replaceIfAlreadyExists = false);
 
-    auto computeCaptureList(Parser::ParseNode funcCode, std::string const& funcName, std::vector<std::string> funcParams) const -> std::vector<std::string>;
+    /// How the code of a scope declares and assigns a name
+    struct Binding
+    {
+        /// Index of the end of its last declaration
+        Parser::ParseNode::difference_type declaredUntil = 0;
+        bool declaredInLoop = false;
+        bool assigned = false;
+    };
+    using Bindings = std::unordered_map<var::string_t, Binding, var::string_hash>;
+
+    static auto compileCode(Parser::ParseTree tree, bool optimizations) -> std::shared_ptr<Code>;
+    static void resolveOpcodes(Code& code, bool optimizations);
+    static void compileFunctions(Code& code, Parser::ParseNode node, Parser::ParseNode source, Bindings const& bindings, bool optimizations);
+    static auto compileFunction(Parser::ParseNode node, Bindings const& bindings, bool optimizations) -> std::shared_ptr<FunctionCode const>;
+    static size_t memorySize(Code const& code);
+    static auto resolveOpcode(Parser::ParseResult const& nodeValue) -> Opcode;
+    static void fuseOpcodes(Code& code, Parser::ParseNode node);
+    static bool isLoopBody(Parser::ParseNode node);
+    static auto scopeBindings(Parser::ParseNode code) -> Bindings;
+    static bool isSingleStep(Code const& code, Parser::ParseNode node);
+    void pushContext(Code& code, var environment, var function = {});
+    void replaceFunctionContext(Function& function, var::properties_t locals, var callee);
+    void pushFunctionContext(Function& function, var::properties_t locals, var callee);
+    void popContext();
+
+    static auto computeCaptureList(Parser::ParseNode funcCode, var::string_t const& funcName, std::vector<var::string_t> funcParams) -> std::vector<var::string_t>;
+
+    /// Without the libraries of Interpreter(), for copyFrom()
+    struct Blank{};
+    explicit Interpreter(Blank){}
+    /// Copies the global environment, charged to this interpreter, and shares the code
+    void copyFrom(Interpreter const& source);
 
     ExecutionContext& context(){ return m_executionStack.top(); }
+    /// Whether the function is one of this interpreter, without locking its lifetime
+    bool owns(Function const& function) const
+    {
+        return !function.interpreter.owner_before(m_lifetime) && !m_lifetime.owner_before(function.interpreter);
+    }
 
     friend std::ostream& operator<<(std::ostream& out, Interpreter const& interpreter);
 
-    std::vector<std::unique_ptr<Parser::ParseTree>> m_parseTrees;
+    /// First member, so that every value of the interpreter can be charged to it
+    var::memory_account* m_memory = var::memory_account::create();
+    /// Expires with the interpreter, its script functions refer to it
+    std::shared_ptr<Interpreter*> m_lifetime = std::make_shared<Interpreter*>(this);
+    std::vector<std::shared_ptr<Code>> m_parseTrees;
     std::stack<ExecutionContext> m_executionStack;
+    /// Emptied calculated maps of finished frames, their buckets are reused by the next frames
+    std::vector<decltype(ExecutionContext::calculated)> m_calculatedPool;
 
     var m_globalEnvironment{std::unordered_map<std::string, var>{}};
+    bool m_optimizations = true;
+    Dispatch m_dispatch = Dispatch::Threaded;
+    unsigned long long m_stepCount = 0;
+    static constexpr auto noStepLimit = std::numeric_limits<unsigned long long>::max();
+    /// Step count at which execute_for() suspends the execution
+    unsigned long long m_stepLimit = noStepLimit;
+    var m_completionValue;
 };
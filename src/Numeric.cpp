@@ -0,0 +1,393 @@
+#include "Numeric.h"
+
+#include <atomic>
+#include <cmath>
+#include <limits>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define NUMERIC_X86_DISPATCH 1
+    #include <immintrin.h>
+#else
+    #define NUMERIC_X86_DISPATCH 0
+#endif
+
+namespace {
+
+struct Kernels
+{
+    double(*sum)(double const*, size_t);
+    double(*min)(double const*, size_t);
+    double(*max)(double const*, size_t);
+    double(*dot)(double const*, double const*, size_t);
+    void(*scale)(double const*, size_t, double, double*);
+    void(*add)(double const*, double const*, size_t, double*);
+    size_t(*filterLess)(double const*, size_t, double, double*);
+    bool vectorized;
+};
+
+constexpr double infinity = std::numeric_limits<double>::infinity();
+constexpr double nan = std::numeric_limits<double>::quiet_NaN();
+
+namespace scalar {
+
+// Independent accumulators keep the additions from waiting on each other
+double sum(double const* data, size_t size)
+{
+    double acc[4] = {0., 0., 0., 0.};
+    size_t i = 0;
+    for(; i + 4 <= size; i += 4){
+        acc[0] += data[i];
+        acc[1] += data[i + 1];
+        acc[2] += data[i + 2];
+        acc[3] += data[i + 3];
+    }
+    for(; i < size; ++i){
+        acc[0] += data[i];
+    }
+    return (acc[0] + acc[1]) + (acc[2] + acc[3]);
+}
+
+double min(double const* data, size_t size)
+{
+    double ret = infinity;
+    for(size_t i = 0; i < size; ++i){
+        if(std::isnan(data[i])){
+            return nan;
+        }
+        ret = data[i] < ret ? data[i] : ret;
+    }
+    return ret;
+}
+
+double max(double const* data, size_t size)
+{
+    double ret = -infinity;
+    for(size_t i = 0; i < size; ++i){
+        if(std::isnan(data[i])){
+            return nan;
+        }
+        ret = data[i] > ret ? data[i] : ret;
+    }
+    return ret;
+}
+
+double dot(double const* a, double const* b, size_t size)
+{
+    double acc[4] = {0., 0., 0., 0.};
+    size_t i = 0;
+    for(; i + 4 <= size; i += 4){
+        acc[0] += a[i] * b[i];
+        acc[1] += a[i + 1] * b[i + 1];
+        acc[2] += a[i + 2] * b[i + 2];
+        acc[3] += a[i + 3] * b[i + 3];
+    }
+    for(; i < size; ++i){
+        acc[0] += a[i] * b[i];
+    }
+    return (acc[0] + acc[1]) + (acc[2] + acc[3]);
+}
+
+void scale(double const* data, size_t size, double factor, double* out)
+{
+    for(size_t i = 0; i < size; ++i){
+        out[i] = data[i] * factor;
+    }
+}
+
+void add(double const* a, double const* b, size_t size, double* out)
+{
+    for(size_t i = 0; i < size; ++i){
+        out[i] = a[i] + b[i];
+    }
+}
+
+size_t filterLess(double const* data, size_t size, double threshold, double* out)
+{
+    size_t count = 0;
+    for(size_t i = 0; i < size; ++i){
+        if(data[i] < threshold){
+            out[count++] = data[i];
+        }
+    }
+    return count;
+}
+
+} // namespace scalar
+
+#if NUMERIC_X86_DISPATCH
+// Same lane grouping as the scalar kernels, so both give the same sums
+namespace avx {
+
+#define NUMERIC_AVX __attribute__((target("avx")))
+
+NUMERIC_AVX double sum(double const* data, size_t size)
+{
+    __m256d acc = _mm256_setzero_pd();
+    size_t i = 0;
+    for(; i + 4 <= size; i += 4){
+        acc = _mm256_add_pd(acc, _mm256_loadu_pd(data + i));
+    }
+    alignas(32) double lanes[4];
+    _mm256_store_pd(lanes, acc);
+    for(; i < size; ++i){
+        lanes[0] += data[i];
+    }
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+template<bool isMin>
+NUMERIC_AVX double extremum(double const* data, size_t size)
+{
+    __m256d acc = _mm256_set1_pd(isMin ? infinity : -infinity);
+    __m256d unordered = _mm256_setzero_pd();
+    size_t i = 0;
+    for(; i + 4 <= size; i += 4){
+        __m256d x = _mm256_loadu_pd(data + i);
+        acc = isMin ? _mm256_min_pd(acc, x) : _mm256_max_pd(acc, x);
+        unordered = _mm256_or_pd(unordered, _mm256_cmp_pd(x, x, _CMP_UNORD_Q));
+    }
+    if(_mm256_movemask_pd(unordered) != 0){
+        return nan;
+    }
+    alignas(32) double lanes[4];
+    _mm256_store_pd(lanes, acc);
+    double ret = isMin ? scalar::min(lanes, 4) : scalar::max(lanes, 4);
+    double rest = isMin ? scalar::min(data + i, size - i) : scalar::max(data + i, size - i);
+    if(std::isnan(rest)){
+        return nan;
+    }
+    return isMin ? (rest < ret ? rest : ret) : (rest > ret ? rest : ret);
+}
+
+NUMERIC_AVX double min(double const* data, size_t size)
+{
+    return extremum<true>(data, size);
+}
+
+NUMERIC_AVX double max(double const* data, size_t size)
+{
+    return extremum<false>(data, size);
+}
+
+NUMERIC_AVX double dot(double const* a, double const* b, size_t size)
+{
+    __m256d acc = _mm256_setzero_pd();
+    size_t i = 0;
+    for(; i + 4 <= size; i += 4){
+        acc = _mm256_add_pd(acc, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    }
+    alignas(32) double lanes[4];
+    _mm256_store_pd(lanes, acc);
+    for(; i < size; ++i){
+        lanes[0] += a[i] * b[i];
+    }
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+NUMERIC_AVX void scale(double const* data, size_t size, double factor, double* out)
+{
+    __m256d f = _mm256_set1_pd(factor);
+    size_t i = 0;
+    for(; i + 4 <= size; i += 4){
+        _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(data + i), f));
+    }
+    scalar::scale(data + i, size - i, factor, out + i);
+}
+
+NUMERIC_AVX void add(double const* a, double const* b, size_t size, double* out)
+{
+    size_t i = 0;
+    for(; i + 4 <= size; i += 4){
+        _mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    }
+    scalar::add(a + i, b + i, size - i, out + i);
+}
+
+NUMERIC_AVX size_t filterLess(double const* data, size_t size, double threshold, double* out)
+{
+    __m256d t = _mm256_set1_pd(threshold);
+    size_t count = 0;
+    size_t i = 0;
+    for(; i + 4 <= size; i += 4){
+        __m256d x = _mm256_loadu_pd(data + i);
+        auto mask = static_cast<unsigned>(_mm256_movemask_pd(_mm256_cmp_pd(x, t, _CMP_LT_OQ)));
+        if(mask == 0xFu){
+            _mm256_storeu_pd(out + count, x);
+            count += 4;
+        } else {
+            for(size_t lane = 0; lane < 4; ++lane){
+                if(mask & (1u << lane)){
+                    out[count++] = data[i + lane];
+                }
+            }
+        }
+    }
+    return count + scalar::filterLess(data + i, size - i, threshold, out + count);
+}
+
+#undef NUMERIC_AVX
+
+} // namespace avx
+#endif
+
+constexpr Kernels scalarKernels{&scalar::sum, &scalar::min, &scalar::max, &scalar::dot, &scalar::scale, &scalar::add, &scalar::filterLess, false};
+#if NUMERIC_X86_DISPATCH
+constexpr Kernels avxKernels{&avx::sum, &avx::min, &avx::max, &avx::dot, &avx::scale, &avx::add, &avx::filterLess, true};
+#endif
+
+Kernels const* bestKernels()
+{
+#if NUMERIC_X86_DISPATCH
+    if(__builtin_cpu_supports("avx")){
+        return &avxKernels;
+    }
+#endif
+    return &scalarKernels;
+}
+
+std::atomic<Kernels const*>& activeKernels()
+{
+    static std::atomic<Kernels const*> s_kernels{bestKernels()};
+    return s_kernels;
+}
+
+Kernels const& kernels()
+{
+    return *activeKernels().load(std::memory_order_relaxed);
+}
+
+/// The converted arguments and the results fit in the memory limit, checked before they are allocated
+void expectNumbers(size_t size)
+{
+    if(auto* account = var::memory_account::current()){
+        account->expect(size * sizeof(double));
+    }
+}
+
+/**
+    Packed arrays and aligned Float64Array are read in place, other arrays are converted into `storage`.
+    The holes of a sparse array would all be converted, however long: it is refused.
+**/
+double const* numbers(var const& v, size_t& size, std::vector<double>& storage)
+{
+    if(auto* data = v.packed_numbers(size)){
+        return data;
+    }
+    if((!v.is_array() && !v.is_typed_array()) || v.is_sparse_array()){
+        throw unavailable_operation();
+    }
+    size = static_cast<size_t>(v.get("length").to_double());
+    expectNumbers(size);
+    storage.resize(size);
+    for(size_t i = 0; i < size; ++i){
+        storage[i] = v.get(static_cast<double>(i)).to_double();
+    }
+    return storage.data();
+}
+
+template<double(*reduce)(double const*, size_t)>
+var reduction(var::args_t args)
+{
+    std::vector<double> storage;
+    size_t size;
+    auto* data = numbers(args[0], size, storage);
+    return reduce(data, size);
+}
+
+} // namespace
+
+var Numeric::library()
+{
+    return var{{
+        {"sum", var(&reduction<&Numeric::sum>)},
+        {"min", var(&reduction<&Numeric::min>)},
+        {"max", var(&reduction<&Numeric::max>)},
+        {"dot", var([](var::args_t args)->var{
+            std::vector<double> storageA, storageB;
+            size_t sizeA, sizeB;
+            auto* a = numbers(args[0], sizeA, storageA);
+            auto* b = numbers(args[1], sizeB, storageB);
+            if(sizeA != sizeB){
+                throw unavailable_operation();
+            }
+            return dot(a, b, sizeA);
+        })},
+        {"scale", var([](var::args_t args)->var{
+            std::vector<double> storage;
+            size_t size;
+            auto* data = numbers(args[0], size, storage);
+            expectNumbers(size);
+            std::vector<double> ret(size);
+            scale(data, size, args[1].to_double(), ret.data());
+            return var::array(std::move(ret));
+        })},
+        {"add", var([](var::args_t args)->var{
+            std::vector<double> storageA, storageB;
+            size_t sizeA, sizeB;
+            auto* a = numbers(args[0], sizeA, storageA);
+            auto* b = numbers(args[1], sizeB, storageB);
+            if(sizeA != sizeB){
+                throw unavailable_operation();
+            }
+            expectNumbers(sizeA);
+            std::vector<double> ret(sizeA);
+            add(a, b, sizeA, ret.data());
+            return var::array(std::move(ret));
+        })},
+        {"filterLess", var([](var::args_t args)->var{
+            std::vector<double> storage;
+            size_t size;
+            auto* data = numbers(args[0], size, storage);
+            expectNumbers(size);
+            std::vector<double> ret(size);
+            ret.resize(filterLess(data, size, args[1].to_double(), ret.data()));
+            return var::array(std::move(ret));
+        })}
+    }};
+}
+
+double Numeric::sum(double const* data, size_t size)
+{
+    return kernels().sum(data, size);
+}
+
+double Numeric::min(double const* data, size_t size)
+{
+    return kernels().min(data, size);
+}
+
+double Numeric::max(double const* data, size_t size)
+{
+    return kernels().max(data, size);
+}
+
+double Numeric::dot(double const* a, double const* b, size_t size)
+{
+    return kernels().dot(a, b, size);
+}
+
+void Numeric::scale(double const* data, size_t size, double factor, double* out)
+{
+    kernels().scale(data, size, factor, out);
+}
+
+void Numeric::add(double const* a, double const* b, size_t size, double* out)
+{
+    kernels().add(a, b, size, out);
+}
+
+size_t Numeric::filterLess(double const* data, size_t size, double threshold, double* out)
+{
+    return kernels().filterLess(data, size, threshold, out);
+}
+
+bool Numeric::vectorized()
+{
+    return kernels().vectorized;
+}
+
+bool Numeric::set_vectorized(bool enabled)
+{
+    activeKernels() = enabled ? bestKernels() : &scalarKernels;
+    return vectorized();
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "var.h"
+
+/**
+    Bulk operations over arrays of numbers. The kernels are vectorized where the
+    CPU supports it, the implementation is chosen once at the first call.
+**/
+class Numeric
+{
+public:
+    /// The `Numeric` object of the global environment
+    static var library();
+
+    static double sum(double const* data, size_t size);
+    /// Infinity when empty, NaN if any element is NaN
+    static double min(double const* data, size_t size);
+    /// -Infinity when empty, NaN if any element is NaN
+    static double max(double const* data, size_t size);
+    static double dot(double const* a, double const* b, size_t size);
+    static void scale(double const* data, size_t size, double factor, double* out);
+    static void add(double const* a, double const* b, size_t size, double* out);
+    /// Copies the elements lower than the threshold to `out`, which holds `size` elements
+    /// @return the number of elements copied
+    static size_t filterLess(double const* data, size_t size, double threshold, double* out);
+
+    /// Whether the vectorized kernels are in use
+    static bool vectorized();
+    /**
+        Falls back to the scalar kernels, or goes back to the vectorized ones where the CPU
+        supports them, to compare both.
+        @return whether the vectorized kernels are now in use
+    **/
+    static bool set_vectorized(bool enabled);
+};
@@ -0,0 +1,160 @@
+#include "Optimizer.h"
+
+#include <functional>
+
+void Optimizer::optimize(Parser::ParseNode tree)
+{
+    optimize_Node(tree);
+}
+
+void Optimizer::optimize_Node(Parser::ParseNode node)
+{
+    for(auto child = node.begin(); child != node.end(); ++child){
+        optimize_Node(child);
+    }
+    if(std::holds_alternative<Parser::Statement>(*node)){
+        optimize_Statement(node);
+    } else if(std::holds_alternative<Parser::Operation>(*node)){
+        optimize_Operation(node);
+    }
+}
+
+void Optimizer::optimize_Statement(Parser::ParseNode node)
+{
+    using Statement = Parser::Statement;
+    switch(std::get<Statement>(*node)){
+    case Statement::STM_If:
+        return optimize_STM_If(node);
+    default:
+        return;
+    }
+}
+
+void Optimizer::optimize_Operation(Parser::ParseNode node)
+{
+    using Operation = Parser::Operation;
+    switch(std::get<Operation>(*node)){
+    case Operation::OPR_Grouping:
+        return optimize_OPR_Grouping(node);
+    case Operation::OPR_Multiplication:
+        return optimize_OPR_BinaryOperation<operator* >(node);
+    case Operation::OPR_Division:
+        return optimize_OPR_BinaryOperation<operator/ >(node);
+    case Operation::OPR_Remainder:
+        return optimize_OPR_BinaryOperation<operator% >(node);
+    case Operation::OPR_Addition:
+        return optimize_OPR_BinaryOperation<operator+ >(node);
+    case Operation::OPR_Subtraction:
+        return optimize_OPR_BinaryOperation<operator- >(node);
+    case Operation::OPR_LessThan:
+        return optimize_OPR_BinaryOperation<operator< >(node);
+    case Operation::OPR_LessThanOrEqual:
+        return optimize_OPR_BinaryOperation<operator<= >(node);
+    case Operation::OPR_GreaterThan:
+        return optimize_OPR_BinaryOperation<operator> >(node);
+    case Operation::OPR_GreaterThanOrEqual:
+        return optimize_OPR_BinaryOperation<operator>= >(node);
+    case Operation::OPR_Equality:
+        return optimize_OPR_BinaryOperation<&var::loose_equals >(node);
+    case Operation::OPR_Inequality:
+        return optimize_OPR_BinaryOperation<&var::differs<&var::loose_equals> >(node);
+    case Operation::OPR_StrictEquality:
+        return optimize_OPR_BinaryOperation<&var::strict_equals >(node);
+    case Operation::OPR_StrictInequality:
+        return optimize_OPR_BinaryOperation<&var::differs<&var::strict_equals> >(node);
+    case Operation::OPR_LogicalAND:
+        return optimize_OPR_LogicalAND(node);
+    case Operation::OPR_LogicalOR:
+        return optimize_OPR_LogicalOR(node);
+    default:
+        return;
+    }
+}
+
+void Optimizer::optimize_STM_If(Parser::ParseNode node)
+{
+    auto condition = node.begin();
+    if(!isLiteral(condition)){
+        return;
+    }
+    if(std::get<Parser::Literal>(*condition).to_bool() == true){
+        replaceWithChild(node, std::next(condition, 1));
+    } else if(node.children() == 3){
+        replaceWithChild(node, std::next(condition, 2));
+    } else {
+        node.clear_children();
+        *node = Parser::Statement::STM_Block;
+    }
+}
+
+void Optimizer::optimize_OPR_Grouping(Parser::ParseNode node)
+{
+    if(node.empty()){
+        return;
+    }
+    for(auto child = node.begin(); child != node.end(); ++child){
+        if(!isLiteral(child)){
+            return;
+        }
+    }
+    replaceWithChild(node, node.last_child());
+}
+
+void Optimizer::optimize_OPR_LogicalAND(Parser::ParseNode node)
+{
+    auto lhs = node.begin();
+    if(!isLiteral(lhs)){
+        return;
+    }
+    if(std::get<Parser::Literal>(*lhs).to_bool() == false){
+        replaceWithChild(node, lhs);
+    } else {
+        replaceWithChild(node, std::next(lhs));
+    }
+}
+
+void Optimizer::optimize_OPR_LogicalOR(Parser::ParseNode node)
+{
+    auto lhs = node.begin();
+    if(!isLiteral(lhs)){
+        return;
+    }
+    if(std::get<Parser::Literal>(*lhs).to_bool() == true){
+        replaceWithChild(node, lhs);
+    } else {
+        replaceWithChild(node, std::next(lhs));
+    }
+}
+
+template<auto operatorPtr>
+void Optimizer::optimize_OPR_BinaryOperation(Parser::ParseNode node)
+{
+    auto lhs = node.begin();
+    auto rhs = std::next(lhs);
+    if(!isLiteral(lhs) || !isLiteral(rhs)){
+        return;
+    }
+    // Operations the interpreter would fail on are left for it to report at runtime
+    try{
+        Parser::Literal value = std::invoke(operatorPtr, std::get<Parser::Literal>(*lhs), std::get<Parser::Literal>(*rhs));
+        replaceWithLiteral(node, std::move(value));
+    }catch(undefined_value&){
+    }catch(unavailable_operation&){
+    }
+}
+
+bool Optimizer::isLiteral(Parser::ParseNode node)
+{
+    return std::holds_alternative<Parser::Literal>(*node);
+}
+
+void Optimizer::replaceWithLiteral(Parser::ParseNode node, Parser::Literal value)
+{
+    node.clear_children();
+    *node = std::move(value);
+}
+
+void Optimizer::replaceWithChild(Parser::ParseNode node, Parser::ParseNode child)
+{
+    node.prune(child);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "Parser.h"
+
+class Optimizer
+{
+public:
+    void optimize(Parser::ParseNode tree);
+
+private:
+    void optimize_Node                          (Parser::ParseNode node);
+    void optimize_Statement                     (Parser::ParseNode node);
+    void optimize_Operation                     (Parser::ParseNode node);
+
+    void optimize_STM_If                        (Parser::ParseNode node);
+
+    void optimize_OPR_Grouping                  (Parser::ParseNode node);
+    void optimize_OPR_LogicalAND                (Parser::ParseNode node);
+    void optimize_OPR_LogicalOR                 (Parser::ParseNode node);
+    template<auto operatorPtr>
+    void optimize_OPR_BinaryOperation           (Parser::ParseNode node);
+
+    static bool isLiteral(Parser::ParseNode node);
+    static void replaceWithLiteral(Parser::ParseNode node, Parser::Literal value);
+    static void replaceWithChild(Parser::ParseNode node, Parser::ParseNode child);
+};
@@ -5,6 +5,8 @@
 #include <memory>
 #include <numeric>
 #include <optional>
+#include <string>
+#include <ostream>
 
 template<class T>
 class ParseTree
@@ -58,6 +60,8 @@ public:
         NodeBase append(T const& child);
         NodeBase append(NodeBase&& child);
         NodeBase append_copy(NodeBase const& other);
+        template<class Pred>
+        NodeBase append_copy(NodeBase const& other, Pred isLeaf);
         NodeBase prepend(T&& child);
         void clear_children();
         NodeBase remove();
@@ -92,9 +96,13 @@ public:
         NodeBase(Tree& tree, TreeIndex index): m_tree(&tree), m_index(index) {}
         NodeBase(Tree* tree, TreeIndex index): m_tree(tree), m_index(index) {}
 
+        template<class It>
+        NodeBase append_range(It srcBegIt, It srcEndIt);
+
     public:
         int weight() const;
         int deep_weight() const;
+        difference_type index() const { return m_index; }
     };
 
     using Node = typename ParseTree::template NodeBase<false>;
@@ -474,34 +482,35 @@ auto ParseTree<T>::NodeBase<Const>::append_copy(NodeBase const& child) -> NodeBa
 {
     static_assert(!Const, "not possible on ConstNode");
 
-    auto childSrcBegIt = child.get(child.m_index);
-    auto childSrcEndIt = child.get(child.end().m_index);
-    auto childSrcSize = std::distance(childSrcBegIt, childSrcEndIt);
-    auto childSrcDeepWeight = child.deep_weight();
-
-    int const lweight = weight();
-    if(lweight <= 0){
-        auto it = m_tree->insert(std::next(get()), childSrcBegIt, childSrcEndIt);
+    return append_range(child.get(child.m_index), child.get(child.end().m_index));
+}
 
-        auto lastChildDestIt = std::next(it, childSrcSize - 1);
-        lastChildDestIt->first = lastChildDestIt->first - childSrcDeepWeight + lweight - 1;
+/**
+    Same as append_copy(), except that the descendants of `child` whose value satisfies `isLeaf`
+    are copied without their own children.
+    @note invalidates all iterators after insertion point
+    @return the node of the appended child
+**/
+template<class T> template<bool Const> template<class Pred>
+auto ParseTree<T>::NodeBase<Const>::append_copy(NodeBase const& child, Pred isLeaf) -> NodeBase
+{
+    static_assert(!Const, "not possible on ConstNode");
 
-        get()->first = 1;
-        return {m_tree, get_index(it)};
+    auto srcIt = child.get(child.m_index);
+    auto srcEndIt = child.get(child.end().m_index);
+
+    std::vector<std::pair<int, T>> copy;
+    copy.push_back(*srcIt++);
+    while(srcIt != srcEndIt){
+        auto& [lweight, value] = copy.emplace_back(*srcIt++);
+        if(lweight > 0 && isLeaf(std::as_const(value))){
+            // the weights of the skipped children add up into the leaf
+            while(lweight > 0){
+                lweight += srcIt++->first;
+            }
+        }
     }
-
-    auto endIt = get(end().m_index);
-    int const dweight = deep_weight();
-
-    auto it = m_tree->insert(endIt, childSrcBegIt, childSrcEndIt);
-
-    auto lastChildDestIt = std::next(it, childSrcSize - 1);
-    lastChildDestIt->first = lastChildDestIt->first - childSrcDeepWeight + dweight - 1;
-
-    auto prevIt = std::prev(it);
-    prevIt->first -= dweight - 1;
-
-    return {m_tree, get_index(it)};
+    return append_range(std::make_move_iterator(copy.begin()), std::make_move_iterator(copy.end()));
 }
 
 template<class T> template<bool Const>
@@ -576,7 +585,7 @@ void ParseTree<T>::NodeBase<Const>::prune(NodeBase& other)
     auto resizeIt = std::move(endIt, m_tree->end(), it);
     m_tree->resize(std::distance(m_tree->begin(), resizeIt));
 
-    std::prev(it)->first += otherDeepWeight - dweight;
+    std::prev(it)->first += dweight - otherDeepWeight;
     other.m_index = m_index;
 }
 
@@ -590,6 +599,43 @@ void ParseTree<T>::NodeBase<Const>::wrap(T&& element)
 
 /// Private
 
+/**
+    Inserts the nodes [srcBegIt, srcEndIt) of a whole subtree as the last child
+    @return the node of the appended child
+**/
+template<class T> template<bool Const> template<class It>
+auto ParseTree<T>::NodeBase<Const>::append_range(It srcBegIt, It srcEndIt) -> NodeBase
+{
+    auto childSrcSize = std::distance(srcBegIt, srcEndIt);
+    int const childSrcDeepWeight = std::accumulate(srcBegIt, srcEndIt, 0, [](int init, auto const& p){
+        return init + p.first;
+    });
+
+    int const lweight = weight();
+    if(lweight <= 0){
+        auto it = m_tree->insert(std::next(get()), srcBegIt, srcEndIt);
+
+        auto lastChildDestIt = std::next(it, childSrcSize - 1);
+        lastChildDestIt->first = lastChildDestIt->first - childSrcDeepWeight + lweight - 1;
+
+        get()->first = 1;
+        return {m_tree, get_index(it)};
+    }
+
+    auto endIt = get(end().m_index);
+    int const dweight = deep_weight();
+
+    auto it = m_tree->insert(endIt, srcBegIt, srcEndIt);
+
+    auto lastChildDestIt = std::next(it, childSrcSize - 1);
+    lastChildDestIt->first = lastChildDestIt->first - childSrcDeepWeight + dweight - 1;
+
+    auto prevIt = std::prev(it);
+    prevIt->first -= dweight - 1;
+
+    return {m_tree, get_index(it)};
+}
+
 template<class T> template<bool Const>
 int ParseTree<T>::NodeBase<Const>::weight() const
 {
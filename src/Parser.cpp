@@ -224,7 +224,7 @@ bool Parser::parse_varDecl(ParseNode tree)
     if(!lex_expect_optional(Lexer::Keyword::KWD_var)){
         return false;
     }
-    auto varDeclNode = tree.append(VarDecl{lex_expect_identifier()});
+    auto varDeclNode = tree.append(VarDecl{var::string_t(lex_expect_identifier())});
     if(lex_expect_optional(Lexer::Punctuator::PCT_equal)){
         parse_evaluationExpression(varDeclNode, 0);
     }
@@ -510,7 +510,7 @@ bool Parser::parse_JsonObjectOperation(ParseNode tree, int opr_precedence)
                 //parse accessors
 */
             } else {
-                operation.append(VarUse{name});
+                operation.append(VarUse{var::string_t(name)});
             }
         }
     }while(lex_expect_optional(Lexer::Punctuator::PCT_comma));
@@ -526,10 +526,10 @@ bool Parser::parse_ArrayObjectOperation(ParseNode tree, int opr_precedence)
     if(!lex_expect_optional(Lexer::Punctuator::PCT_bracket_left)){
         return false;
     }
+    auto operation = tree.append(Operation::OPR_ArrayObject);
     if(lex_expect_optional(Lexer::Punctuator::PCT_bracket_right)){
         return true;
     }
-    auto operation = tree.append(Operation::OPR_ArrayObject);
     do{
         if(!parse_evaluationExpression(operation, 0)){
             operation.append(var{});
@@ -556,7 +556,7 @@ bool Parser::parse_FunctionOperation(ParseNode tree, int opr_precedence)
     lex_expect(Lexer::Punctuator::PCT_parenthese_left);
     if(!lex_expect_optional(Lexer::Punctuator::PCT_parenthese_right)){
         do{
-            operation.append(VarDecl{lex_expect_identifier()});
+            operation.append(VarDecl{var::string_t(lex_expect_identifier())});
         }while(lex_expect_optional(Lexer::Punctuator::PCT_comma));
         lex_expect(Lexer::Punctuator::PCT_parenthese_right);
     }
@@ -694,7 +694,7 @@ bool Parser::parse_Literal(ParseNode tree)
 bool Parser::parse_varUse(ParseNode tree)
 {
     if(auto ident = lex_expect_optional_identifier()){
-        tree.append(VarUse{std::move(*ident)});
+        tree.append(VarUse{var::string_t(*ident)});
         return true;
     }
     return false;
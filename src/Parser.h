@@ -10,12 +10,12 @@ public:
 
     struct VarDecl
     {
-        std::string name;
+        var::string_t name;
     };
 
     struct VarUse
     {
-        std::string name;
+        var::string_t name;
     };
 
     enum class Statement
@@ -0,0 +1,136 @@
+#include "var.h"
+
+#if VAR_ATOMIC_REFCOUNT
+#include "Scheduler.h"
+
+#include <algorithm>
+
+namespace {
+
+/// The values freed by a collection may release others which are buffered again
+void collectAllCycles()
+{
+    while(var::collect_cycles() > 0){}
+}
+
+} // namespace
+
+Scheduler::Scheduler(size_t workers, unsigned long long sliceSteps):
+    m_sliceSteps(sliceSteps)
+{
+    for(size_t i = 0; i < std::max<size_t>(workers, 1); ++i){
+        m_workers.push_back(std::make_unique<Worker>());
+    }
+    for(size_t i = 0; i < m_workers.size(); ++i){
+        m_workers[i]->thread = std::thread(&Scheduler::work, this, i);
+    }
+}
+
+Scheduler::~Scheduler()
+{
+    {
+        std::lock_guard lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wakeup.notify_all();
+    for(auto& worker : m_workers){
+        worker->thread.join();
+    }
+}
+
+std::future<var> Scheduler::submit(std::shared_ptr<Interpreter> interpreter)
+{
+    auto task = std::make_unique<Task>();
+    task->interpreter = std::move(interpreter);
+    auto ret = task->promise.get_future();
+    push(m_nextWorker.fetch_add(1, std::memory_order_relaxed) % m_workers.size(), std::move(task));
+    return ret;
+}
+
+void Scheduler::push(size_t index, std::unique_ptr<Task> task)
+{
+    {
+        std::lock_guard lock(m_workers[index]->mutex);
+        m_workers[index]->tasks.push_back(std::move(task));
+    }
+    // Either the sleeper sees the task, or the count of sleepers is seen here
+    m_queued.fetch_add(1);
+    if(m_sleeping.load() > 0){
+        std::lock_guard lock(m_mutex);
+        m_wakeup.notify_one();
+    }
+}
+
+/// The oldest task of the worker, else the newest task of another worker
+auto Scheduler::take(size_t index) -> std::unique_ptr<Task>
+{
+    for(size_t i = 0; i < m_workers.size(); ++i){
+        auto& worker = *m_workers[(index + i) % m_workers.size()];
+        std::lock_guard lock(worker.mutex);
+        if(worker.tasks.empty()){
+            continue;
+        }
+        std::unique_ptr<Task> task;
+        if(i == 0){
+            task = std::move(worker.tasks.front());
+            worker.tasks.pop_front();
+        } else {
+            task = std::move(worker.tasks.back());
+            worker.tasks.pop_back();
+        }
+        m_queued.fetch_sub(1);
+        return task;
+    }
+    return nullptr;
+}
+
+void Scheduler::work(size_t index)
+{
+    while(!m_stopping){
+        if(auto task = take(index)){
+            if(runSlice(*task)){
+                push(index, std::move(task));
+            }
+            continue;
+        }
+        std::unique_lock lock(m_mutex);
+        m_sleeping.fetch_add(1);
+        m_wakeup.wait(lock, [this]{ return m_stopping || m_queued.load() > 0; });
+        m_sleeping.fetch_sub(1);
+    }
+}
+
+bool Scheduler::runSlice(Task& task)
+{
+    auto status = Interpreter::Status::Completed;
+    std::exception_ptr error;
+    try {
+        status = task.interpreter->execute_for(m_sliceSteps);
+    } catch(...) {
+        error = std::current_exception();
+    }
+    if(status == Interpreter::Status::Suspended && !error){
+        // The possible cycle roots of this thread refer to the values of the interpreter,
+        // which may resume on another thread
+        collectAllCycles();
+        return true;
+    }
+
+    // Releasing the interpreter buffers the values it leaves to the result as possible
+    // cycle roots of this thread: they are collected before the host can read the result
+    auto promise = std::move(task.promise);
+    var result;
+    if(!error){
+        result = task.interpreter->completionValue();
+    }
+    task.interpreter.reset();
+    collectAllCycles();
+    if(error){
+        promise.set_exception(error);
+    } else {
+        promise.set_value(std::move(result));
+    }
+    return false;
+}
+
+#endif
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "Interpreter.h"
+
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if !VAR_ATOMIC_REFCOUNT
+    #error "The scheduler moves interpreters between threads, build with VAR_ATOMIC_REFCOUNT=1"
+#endif
+
+/**
+    Runs many interpreters on a few worker threads. Each worker takes the interpreters
+    of its own queue in turn and runs them one slice of steps at a time, an idle worker
+    steals from the others. Host functions are called on the workers.
+
+    An interpreter may resume on another worker than the one of its previous slice: values
+    must not be shared between the interpreters of a scheduler, unless they are immortal.
+**/
+class Scheduler
+{
+public:
+    explicit Scheduler(size_t workers = std::thread::hardware_concurrency(), unsigned long long sliceSteps = 10000);
+    /// Finishes the slices in progress, the interpreters left are dropped with their futures
+    ~Scheduler();
+    Scheduler(Scheduler const&) = delete;
+    Scheduler& operator=(Scheduler const&) = delete;
+
+    /**
+        Runs the code fed to the interpreter until its stack is empty. No other thread may use
+        the interpreter meanwhile.
+        @return the completion value, or the exception thrown by the execution
+    **/
+    std::future<var> submit(std::shared_ptr<Interpreter> interpreter);
+
+    size_t workers() const { return m_workers.size(); }
+
+private:
+    struct Task
+    {
+        std::shared_ptr<Interpreter> interpreter;
+        std::promise<var> promise;
+    };
+
+    struct Worker
+    {
+        std::mutex mutex;
+        /// Taken from the front by the worker, stolen from the back by the others
+        std::deque<std::unique_ptr<Task>> tasks;
+        std::thread thread;
+    };
+
+    void work(size_t index);
+    std::unique_ptr<Task> take(size_t index);
+    void push(size_t index, std::unique_ptr<Task> task);
+    /// @return whether the interpreter is left suspended
+    bool runSlice(Task& task);
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    unsigned long long m_sliceSteps;
+    /// Worker of the next submission
+    std::atomic<size_t> m_nextWorker{0};
+
+    /// Idle workers sleep until a task is queued
+    std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+    std::atomic<size_t> m_queued{0};
+    std::atomic<size_t> m_sleeping{0};
+    std::atomic<bool> m_stopping{false};
+};
@@ -1,8 +1,12 @@
 #include "var.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <iomanip>
+#include <mutex>
 
 #define UNIMPLEMENTED assert(0 && "UNIMPLEMENTED"); throw unavailable_operation();
 
@@ -11,34 +15,180 @@
 const var var::undefined{};
 
 var::var(std::string const& str):
-    m_value(std::make_shared<var_t>(str))
+    m_value(value_ptr::make(string_t(str)))
+{}
+
+var::var(char const* c_str):
+    m_value(value_ptr::make(string_t(c_str)))
 {}
 
 var::var(std::regex const& rgx):
-    m_value(std::make_shared<var_t>(rgx))
+    m_value(value_ptr::make(rgx))
 {}
 
 var::var(double d):
-    m_value(std::make_shared<var_t>(d))
+    m_value(value_ptr::make(d))
 {}
 
-var::var(bool b):
-    m_value(std::make_shared<var_t>(b))
-{}
+// Immutable payloads shared by every boolean and null var, on every thread
+var::var(bool b)
+{
+    static const var s_true = immortal([]{ var ret; ret.m_value = value_ptr::make(true); return ret; });
+    static const var s_false = immortal([]{ var ret; ret.m_value = value_ptr::make(false); return ret; });
+    m_value = (b ? s_true : s_false).m_value;
+}
 
-var::var(std::nullptr_t):
-    m_value(std::make_shared<var_t>(nullptr))
-{}
+var::var(std::nullptr_t)
+{
+    static const var s_null = immortal([]{ var ret; ret.m_value = value_ptr::make(nullptr); return ret; });
+    m_value = s_null.m_value;
+}
 
 var::var(function_t f):
-    m_value(std::make_shared<var_t>(std::move(f)))
+    m_value(value_ptr::make(std::move(f)))
 {}
 
-var::var(std::unordered_map<std::string, var> p, var prototype) try :
-    m_value(std::make_shared<var_t>(object_t{((prototype.is_null() || prototype.is_undefined()) ? nullptr : prototype), std::move(p)}))
+var::var(std::shared_ptr<ScriptFunction> function):
+    m_value(value_ptr::make(std::move(function)))
 {}
-catch(std::bad_variant_access&){
-    throw std::invalid_argument("TypeError: Object prototype may only be an Object or null: " + prototype.to_string());
+
+var::var(std::unordered_map<std::string, var> p, var prototype)
+{
+    properties_t properties;
+    properties.reserve(p.size());
+    for(auto& [name, value] : p){
+        properties.emplace(string_t(name), std::move(value));
+    }
+    *this = object(std::move(properties), std::move(prototype));
+}
+
+var var::object(properties_t properties, var prototype)
+{
+    if(!prototype.is_null() && !prototype.is_undefined() && !std::holds_alternative<object_t>(*prototype.m_value)){
+        throw std::invalid_argument("TypeError: Object prototype may only be an Object or null: " + prototype.to_string());
+    }
+    var ret;
+    ret.m_value = value_ptr::make(object_t{prototype.is_undefined() ? nullptr : std::move(prototype), std::move(properties)});
+    return ret;
+}
+
+var var::array(std::vector<var> elements)
+{
+    bool numbers = std::all_of(elements.begin(), elements.end(), [](var const& element){
+        return element.m_value && std::holds_alternative<double>(*element.m_value);
+    });
+    if(!numbers){
+        var ret;
+        ret.m_value = value_ptr::make(array_t{std::move(elements)});
+        return ret;
+    }
+    std::vector<double> packed;
+    packed.reserve(elements.size());
+    for(auto& element : elements){
+        packed.push_back(std::get<double>(*element.m_value));
+    }
+    return array(std::move(packed));
+}
+
+var var::array(std::vector<double> numbers)
+{
+    var ret;
+    ret.m_value = value_ptr::make(array_t{std::move(numbers)});
+    return ret;
+}
+
+var var::array_buffer(size_t size)
+{
+    std::shared_ptr<std::byte[]> memory(new std::byte[size]());
+    auto ret = array_buffer(memory.get(), size, memory);
+    std::get<buffer_t>(*ret.m_value).owned = true;
+    return ret;
+}
+
+var var::array_buffer(void* data, size_t size, std::shared_ptr<void> owner)
+{
+    var ret;
+    ret.m_value = value_ptr::make(buffer_t{static_cast<std::byte*>(data), size, std::move(owner)});
+    return ret;
+}
+
+var var::typed_array(element_type type, var buffer, size_t offset, size_t length)
+{
+    if(!buffer.is_array_buffer()){
+        throw std::invalid_argument("TypeError: Typed array buffer must be an ArrayBuffer: " + buffer.to_string());
+    }
+    auto bufferSize = std::get<buffer_t>(*buffer.m_value).size;
+    auto size = elementSize(type);
+    if(offset % size != 0 || offset > bufferSize){
+        throw std::invalid_argument("RangeError: Invalid typed array offset: " + std::to_string(offset));
+    }
+    if(length == npos){
+        length = (bufferSize - offset) / size;
+    }
+    if(length > (bufferSize - offset) / size){
+        throw std::invalid_argument("RangeError: Invalid typed array length: " + std::to_string(length));
+    }
+    var ret;
+    ret.m_value = value_ptr::make(typed_array_t{std::move(buffer), type, offset, length});
+    return ret;
+}
+
+var var::typed_array(element_type type, size_t length)
+{
+    return typed_array(type, array_buffer(length * elementSize(type)));
+}
+
+std::byte* var::data() const
+{
+    if(!m_value){
+        return nullptr;
+    }
+    if(auto buffer = std::get_if<buffer_t>(&*m_value); buffer){
+        return buffer->data;
+    }
+    if(auto arr = std::get_if<typed_array_t>(&*m_value); arr){
+        return std::get<buffer_t>(*arr->buffer.m_value).data + arr->offset;
+    }
+    return nullptr;
+}
+
+double* var::packed_numbers(size_t& size) const
+{
+    if(!m_value){
+        return nullptr;
+    }
+    if(auto arr = std::get_if<array_t>(&*m_value); arr){
+        auto numbers = std::get_if<std::vector<double>>(&arr->elements);
+        if(!numbers){
+            return nullptr;
+        }
+        size = numbers->size();
+        return numbers->data();
+    }
+    if(auto arr = std::get_if<typed_array_t>(&*m_value); arr && arr->type == element_type::Float64){
+        // Host memory may be unaligned, its elements are then copied by the caller
+        auto* elements = data();
+        if(reinterpret_cast<std::uintptr_t>(elements) % alignof(double) != 0){
+            return nullptr;
+        }
+        size = arr->length;
+        return reinterpret_cast<double*>(elements);
+    }
+    return nullptr;
+}
+
+size_t var::byte_length() const
+{
+    if(!m_value){
+        return 0;
+    }
+    if(auto buffer = std::get_if<buffer_t>(&*m_value); buffer){
+        return buffer->size;
+    }
+    if(auto arr = std::get_if<typed_array_t>(&*m_value); arr){
+        return arr->length * elementSize(arr->type);
+    }
+    return 0;
 }
 
 
@@ -52,15 +202,53 @@ bool var::is_null() const
     return m_value && std::holds_alternative<std::nullptr_t>(*m_value);
 }
 
+bool var::is_string() const
+{
+    flatten();
+    return m_value && std::holds_alternative<string_t>(*m_value);
+}
+
 bool var::is_callable() const
 {
-    return m_value && std::holds_alternative<function_t>(*m_value);
+    return m_value && (std::holds_alternative<function_t>(*m_value)
+                       || std::holds_alternative<script_function_t>(*m_value));
+}
+
+bool var::is_array() const
+{
+    return m_value && std::holds_alternative<array_t>(*m_value);
+}
+
+bool var::is_sparse_array() const
+{
+    auto arr = m_value ? std::get_if<array_t>(&*m_value) : nullptr;
+    return arr && std::holds_alternative<array_t::sparse_t>(arr->elements);
+}
+
+bool var::is_array_buffer() const
+{
+    return m_value && std::holds_alternative<buffer_t>(*m_value);
+}
+
+bool var::is_typed_array() const
+{
+    return m_value && std::holds_alternative<typed_array_t>(*m_value);
+}
+
+ScriptFunction* var::script_function() const
+{
+    if(!m_value){
+        return nullptr;
+    }
+    auto function = std::get_if<script_function_t>(&*m_value);
+    return function ? function->get() : nullptr;
 }
 
 ///Conversions
 
 std::string var::to_string() const
 {
+    flatten();
     if(!m_value)
         return "undefined";
 
@@ -73,20 +261,20 @@ std::string var::to_string() const
             std::stringstream strstr;
             strstr << std::defaultfloat << std::setprecision(std::numeric_limits<double>::max_digits10 + 1) << arg;
             return strstr.str();
-        } else if constexpr(ISSAME(arg, std::string)){
-            return arg;
+        } else if constexpr(ISSAME(arg, string_t)){
+            return std::string(arg.view());
         } else if constexpr(ISSAME(arg, std::regex)){
             return "regex";
-        } else if constexpr(ISSAME(arg, function_t)){
+        } else if constexpr(ISSAME(arg, function_t) || ISSAME(arg, script_function_t)){
             return "function";
         } else if constexpr(ISSAME(arg, object_t)){
             std::stringstream strstr;
             strstr << '{';
             for(auto& [key, value]: arg.properties){
-                strstr << std::quoted(key);
+                strstr << std::quoted(key.view());
                 strstr << ':';
-                if(value.m_value && std::holds_alternative<std::string>(*value.m_value)){
-                    strstr << std::quoted(value.to_string());
+                if(value.is_string()){
+                    strstr << std::quoted(std::get<string_t>(*value.m_value).view());
                 } else {
                     strstr << value.to_string();
                 }
@@ -99,10 +287,78 @@ std::string var::to_string() const
                 str += '}';
             }
             return str;
+        } else if constexpr(ISSAME(arg, array_t)){
+            std::stringstream strstr;
+            strstr << '[';
+            auto print = [&strstr](var const& value){
+                if(value.is_string()){
+                    strstr << std::quoted(std::get<string_t>(*value.m_value).view());
+                } else {
+                    strstr << value.to_string();
+                }
+            };
+            std::visit([&strstr, &print](auto& elements){
+                if constexpr(ISSAME(elements, array_t::sparse_t)){
+                    // The runs of holes are counted rather than printed
+                    size_t next = 0;
+                    for(auto& [index, value] : elements.elements){
+                        if(next > 0){
+                            strstr << ',';
+                        }
+                        if(index > next){
+                            strstr << "<" << index - next << " empty items>,";
+                        }
+                        print(value);
+                        next = index + 1;
+                    }
+                    if(elements.length > next){
+                        strstr << (next > 0 ? "," : "") << "<" << elements.length - next << " empty items>";
+                    }
+                } else {
+                    for(size_t i = 0; i < elements.size(); ++i){
+                        if(i > 0){
+                            strstr << ',';
+                        }
+                        print(elements[i]);
+                    }
+                }
+            }, arg.elements);
+            strstr << ']';
+            return strstr.str();
+        } else if constexpr(ISSAME(arg, buffer_t)){
+            return "ArrayBuffer";
+        } else if constexpr(ISSAME(arg, typed_array_t)){
+            std::stringstream strstr;
+            strstr << '[';
+            for(size_t i = 0; i < arg.length; ++i){
+                if(i > 0){
+                    strstr << ',';
+                }
+                strstr << var(loadElement(arg, i)).to_string();
+            }
+            strstr << ']';
+            return strstr.str();
         } else throw unavailable_operation();
     }, *m_value);
 }
 
+std::string_view var::to_string_view(std::string& storage) const
+{
+    if(is_string()){
+        return std::get<string_t>(*m_value).view();
+    }
+    storage = to_string();
+    return storage;
+}
+
+auto var::to_key() const -> string_t
+{
+    if(is_string()){
+        return std::get<string_t>(*m_value);
+    }
+    return string_t::take(to_string());
+}
+
 std::regex var::to_regex() const
 {
     UNIMPLEMENTED
@@ -110,6 +366,7 @@ std::regex var::to_regex() const
 
 double var::to_double() const
 {
+    flatten();
     if(!m_value)
         return 0;
 
@@ -120,9 +377,9 @@ double var::to_double() const
             return arg;
         } else if constexpr(ISSAME(arg, double)){
             return arg;
-        } else if constexpr(ISSAME(arg, std::string)){
+        } else if constexpr(ISSAME(arg, string_t)){
             try{
-                return std::stod(arg);
+                return std::stod(arg.data());
             }catch(std::invalid_argument&){
                 return NAN;
             }
@@ -132,12 +389,26 @@ double var::to_double() const
                 return (*propToDouble)().to_double();
             }
             return 0;
+        } else if constexpr(ISSAME(arg, array_t)){
+            auto length = arrayLength(arg);
+            if(length > 1){
+                return NAN;
+            }
+            return length == 0 ? 0. : loadElement(arg, 0).to_double();
+        } else if constexpr(ISSAME(arg, buffer_t)){
+            return NAN;
+        } else if constexpr(ISSAME(arg, typed_array_t)){
+            if(arg.length > 1){
+                return NAN;
+            }
+            return arg.length == 0 ? 0. : loadElement(arg, 0);
         } else throw unavailable_operation();
     }, *m_value);
 }
 
 bool var::to_bool() const
 {
+    flatten();
     if(!m_value)
         return false;
 
@@ -148,7 +419,7 @@ bool var::to_bool() const
             return arg;
         } else if constexpr(ISSAME(arg, double)){
             return arg != 0. && !std::isnan(arg);
-        } else if constexpr(ISSAME(arg, std::string)){
+        } else if constexpr(ISSAME(arg, string_t)){
             return !arg.empty();
         } else if constexpr(ISSAME(arg, object_t)){
             if(auto propToBool = findProperty(arg, "to_bool");
@@ -156,23 +427,34 @@ bool var::to_bool() const
                 return (*propToBool)().to_double();
             }
             return true;
+        } else if constexpr(ISSAME(arg, array_t) || ISSAME(arg, buffer_t) || ISSAME(arg, typed_array_t)){
+            return true;
         } else throw unavailable_operation();
     }, *m_value);
 }
 
-var var::operator()(std::vector<var> args)
+var var::operator()(std::vector<var> const& args)
+{
+    return operator()(args_t(args));
+}
+
+var var::operator()(args_t args)
 {
     if(!m_value)
         throw undefined_value();
 
     if(auto func = std::get_if<function_t>(&*m_value); func){
-        return (*func)(std::move(args));
+        return (*func)(args);
+    }
+
+    if(auto func = std::get_if<script_function_t>(&*m_value); func){
+        return (**func)(args);
     }
 
     if(auto obj = std::get_if<object_t>(&*m_value); obj){
         if(auto oprCall = findProperty(*obj, "operator()");
                 oprCall && oprCall->is_callable()){
-            return (*oprCall)(std::move(args));
+            return (*oprCall)(args);
         }
     }
 
@@ -186,7 +468,25 @@ var& var::operator[](var property)
 
     var_t& value = *m_value;
 
-    auto obj = std::get_if<object_t>(&value);
+    if(std::holds_alternative<array_t>(value)){
+        size_t index;
+        if(!arrayIndex(property, index))
+            throw unavailable_operation();
+        auto& ret = element(m_value.m_node, index);
+        recharge(m_value.m_node);
+        return ret;
+    }
+
+    string_t storage;
+    return (*this)[propertyName(property, storage)];
+}
+
+var& var::operator[](string_t const& property)
+{
+    if(!m_value)
+        throw undefined_value();
+
+    auto obj = std::get_if<object_t>(&*m_value);
     if(!obj){
         //obj = s_getPrototype(value);
     }
@@ -194,17 +494,45 @@ var& var::operator[](var property)
     if(!obj)
         throw unavailable_operation();
 
-    auto prop_str = property.to_string();
-
-    auto foundProp = findProperty(*obj, prop_str);
+    auto foundProp = findProperty(*obj, property);
     if(foundProp){
         return *foundProp;
     }
 
-    return obj->properties.emplace(std::move(prop_str), var{}).first->second;
+    // The new property, and the buckets of a rehash
+    auto& properties = obj->properties;
+    size_t growth = sizeof(*properties.begin()) + 2 * sizeof(void*);
+    if(static_cast<float>(properties.size() + 1) > static_cast<float>(properties.bucket_count()) * properties.max_load_factor()){
+        growth += properties.bucket_count() * sizeof(void*);
+    }
+    chargeGrowth(m_value.m_node, growth);
+    auto& ret = properties.emplace(property, var{}).first->second;
+    recharge(m_value.m_node);
+    return ret;
 }
 
-var const& var::operator[](var property) const
+var& var::operator[](char const* property)
+{
+    return (*this)[var(property)];
+}
+
+var var::operator[](var property) const
+{
+    if(!m_value)
+        throw undefined_value();
+
+    if(auto arr = std::get_if<array_t>(&*m_value); arr){
+        size_t index;
+        if(!arrayIndex(property, index))
+            return undefined;
+        return loadElement(*arr, index);
+    }
+
+    string_t storage;
+    return (*this)[propertyName(property, storage)];
+}
+
+var const& var::operator[](string_t const& property) const
 {
     if(!m_value)
         throw undefined_value();
@@ -214,9 +542,7 @@ var const& var::operator[](var property) const
     if(!obj)
         throw unavailable_operation();
 
-    auto prop_str = property.to_string();
-
-    auto foundProp = findProperty(*obj, prop_str);
+    auto foundProp = findProperty(*obj, property);
     if(foundProp){
         return *foundProp;
     }
@@ -224,7 +550,360 @@ var const& var::operator[](var property) const
     return undefined;
 }
 
-auto var::findProperty(object_t& obj, std::string const& propertyName) -> var*
+var var::operator[](char const* property) const
+{
+    return (*this)[var(property)];
+}
+
+var var::get(var const& property) const
+{
+    if(!m_value)
+        throw undefined_value();
+
+    if(auto arr = std::get_if<array_t>(&*m_value); arr){
+        size_t index;
+        if(arrayIndex(property, index)){
+            return loadElement(*arr, index);
+        }
+        static const var s_push = immortal([]{
+            return var(function_t([](args_t args) -> var{
+                auto self = args.self().m_value;
+                auto target = self ? std::get_if<array_t>(&*self) : nullptr;
+                if(!target)
+                    throw unavailable_operation();
+                auto size = arrayLength(*target);
+                for(auto& arg : args){
+                    storeElement(self.m_node, size++, arg);
+                }
+                recharge(self.m_node);
+                return static_cast<double>(size);
+            }));
+        });
+        static const var s_pop = immortal([]{
+            return var(function_t([](args_t args) -> var{
+                auto self = args.self().m_value;
+                auto target = self ? std::get_if<array_t>(&*self) : nullptr;
+                if(!target)
+                    throw unavailable_operation();
+                return std::visit([](auto& elements) -> var{
+                    if constexpr(ISSAME(elements, array_t::sparse_t)){
+                        if(elements.length == 0){
+                            return undefined;
+                        }
+                        auto last = elements.elements.extract(--elements.length);
+                        return last ? std::move(last.mapped()) : undefined;
+                    } else {
+                        if(elements.empty()){
+                            return undefined;
+                        }
+                        var last = std::move(elements.back());
+                        elements.pop_back();
+                        return last;
+                    }
+                }, target->elements);
+            }));
+        });
+        std::string storage;
+        auto name = property.to_string_view(storage);
+        if(name == "length"){
+            return static_cast<double>(arrayLength(*arr));
+        }
+        if(name == "push"){
+            return s_push;
+        }
+        if(name == "pop"){
+            return s_pop;
+        }
+        return undefined;
+    }
+
+    if(auto arr = std::get_if<typed_array_t>(&*m_value); arr){
+        size_t index;
+        if(arrayIndex(property, index)){
+            return index < arr->length ? var(loadElement(*arr, index)) : undefined;
+        }
+        std::string storage;
+        auto name = property.to_string_view(storage);
+        if(name == "length"){
+            return static_cast<double>(arr->length);
+        }
+        if(name == "byteLength"){
+            return static_cast<double>(byte_length());
+        }
+        if(name == "byteOffset"){
+            return static_cast<double>(arr->offset);
+        }
+        if(name == "buffer"){
+            return arr->buffer;
+        }
+        return undefined;
+    }
+
+    if(auto buffer = std::get_if<buffer_t>(&*m_value); buffer){
+        std::string storage;
+        return property.to_string_view(storage) == "byteLength" ? var(static_cast<double>(buffer->size)) : undefined;
+    }
+
+    auto obj = std::get_if<object_t>(&*m_value);
+
+    if(!obj)
+        throw unavailable_operation();
+
+    string_t storage;
+    auto foundProp = findProperty(*obj, propertyName(property, storage));
+    return foundProp ? *foundProp : undefined;
+}
+
+void var::set(var const& property, var value)
+{
+    if(!m_value)
+        throw undefined_value();
+
+    if(auto typedArr = std::get_if<typed_array_t>(&*m_value); typedArr){
+        size_t index;
+        if(!arrayIndex(property, index))
+            throw unavailable_operation();
+        // Out of bounds writes are ignored
+        if(index < typedArr->length){
+            storeElement(*typedArr, index, value.to_double());
+        }
+        return;
+    }
+
+    auto arr = std::get_if<array_t>(&*m_value);
+    if(!arr){
+        (*this)[property] = std::move(value);
+        return;
+    }
+
+    size_t index;
+    if(arrayIndex(property, index)){
+        storeElement(m_value.m_node, index, std::move(value));
+        recharge(m_value.m_node);
+        return;
+    }
+    std::string storage;
+    if(property.to_string_view(storage) != "length" || !arrayIndex(value, index))
+        throw unavailable_operation();
+    resizeElements(m_value.m_node, index);
+    recharge(m_value.m_node);
+}
+
+var const& var::property_owner(string_t const& property) const
+{
+    for(var const* proto = this; proto->m_value; ){
+        auto obj = std::get_if<object_t>(&*proto->m_value);
+        if(!obj){
+            break;
+        }
+        if(obj->properties.count(property)){
+            return *proto;
+        }
+        proto = &obj->prototype;
+    }
+    return undefined;
+}
+
+auto var::unpack(array_t& arr) -> std::vector<var>&
+{
+    if(auto numbers = std::get_if<std::vector<double>>(&arr.elements); numbers){
+        std::vector<var> values(numbers->begin(), numbers->end());
+        arr.elements = std::move(values);
+    }
+    return std::get<std::vector<var>>(arr.elements);
+}
+
+/**
+    @param[out] index the property as an array index, if it is one
+**/
+bool var::arrayIndex(var const& property, size_t& index)
+{
+    auto d = property.m_value ? std::get_if<double>(&*property.m_value) : nullptr;
+    if(!d || !(*d >= 0) || *d != std::floor(*d) || *d >= 4294967295.){
+        return false;
+    }
+    index = static_cast<size_t>(*d);
+    return true;
+}
+
+/**
+    Growing at most to twice the size, plus some, stays dense: the holes cost as much as
+    the elements. Past it, as a single store far past the end would do, the array turns sparse.
+**/
+namespace {
+
+bool staysDense(size_t size, size_t length)
+{
+    constexpr size_t minGrowth = 1024;
+    return length <= size + std::max(size, minGrowth);
+}
+
+} // namespace
+
+size_t var::arrayLength(array_t const& arr)
+{
+    return std::visit([](auto& elements) -> size_t{
+        if constexpr(ISSAME(elements, array_t::sparse_t)){
+            return elements.length;
+        } else {
+            return elements.size();
+        }
+    }, arr.elements);
+}
+
+/// Undefined for the holes and past the end
+var var::loadElement(array_t const& arr, size_t index)
+{
+    return std::visit([index](auto& elements) -> var{
+        if constexpr(ISSAME(elements, array_t::sparse_t)){
+            auto it = elements.elements.find(index);
+            return it != elements.elements.end() ? it->second : undefined;
+        } else {
+            return index < elements.size() ? var(elements[index]) : undefined;
+        }
+    }, arr.elements);
+}
+
+/**
+    The element at the index, boxed so that it can be referred to. Past the end the
+    array grows and any gap is undefined.
+**/
+var& var::element(node_t* node, size_t index)
+{
+    auto& arr = std::get<array_t>(node->value);
+    if(!std::holds_alternative<array_t::sparse_t>(arr.elements) && !staysDense(arrayLength(arr), index + 1)){
+        makeSparse(arr);
+    }
+    if(auto sparse = std::get_if<array_t::sparse_t>(&arr.elements)){
+        sparse->length = std::max(sparse->length, index + 1);
+        return sparse->elements[index];
+    }
+    auto& values = unpack(arr);
+    if(index >= values.size()){
+        chargeGrowth(node, values, index + 1);
+        values.resize(index + 1);
+    }
+    return values[index];
+}
+
+/**
+    Stores the element at the index, a number stays packed where the other elements are numbers.
+**/
+void var::storeElement(node_t* node, size_t index, var value)
+{
+    auto& arr = std::get<array_t>(node->value);
+    if(auto numbers = std::get_if<std::vector<double>>(&arr.elements); numbers){
+        auto d = value.m_value ? std::get_if<double>(&*value.m_value) : nullptr;
+        if(d && index < numbers->size()){
+            (*numbers)[index] = *d;
+            return;
+        }
+        if(d && index == numbers->size()){
+            chargeGrowth(node, *numbers, index + 1);
+            numbers->push_back(*d);
+            return;
+        }
+    }
+    element(node, index) = std::move(value);
+}
+
+/// The new elements are undefined
+void var::resizeElements(node_t* node, size_t length)
+{
+    auto& arr = std::get<array_t>(node->value);
+    auto size = arrayLength(arr);
+    if(length > size && !std::holds_alternative<array_t::sparse_t>(arr.elements) && !staysDense(size, length)){
+        makeSparse(arr);
+    }
+    if(auto sparse = std::get_if<array_t::sparse_t>(&arr.elements)){
+        sparse->elements.erase(sparse->elements.lower_bound(length), sparse->elements.end());
+        sparse->length = length;
+    } else if(length > size){
+        auto& values = unpack(arr);
+        chargeGrowth(node, values, length);
+        values.resize(length);
+    } else {
+        std::visit([length](auto& elements){
+            if constexpr(!ISSAME(elements, array_t::sparse_t)){
+                elements.resize(length);
+            }
+        }, arr.elements);
+    }
+}
+
+void var::makeSparse(array_t& arr)
+{
+    array_t::sparse_t sparse;
+    sparse.length = arrayLength(arr);
+    std::visit([&sparse](auto& elements){
+        if constexpr(!ISSAME(elements, array_t::sparse_t)){
+            for(size_t i = 0; i < elements.size(); ++i){
+                sparse.elements.emplace_hint(sparse.elements.end(), i, std::move(elements[i]));
+            }
+        }
+    }, arr.elements);
+    arr.elements = std::move(sparse);
+}
+
+size_t var::elementSize(element_type type)
+{
+    switch(type){
+    case element_type::Float64:
+        return sizeof(double);
+    case element_type::Int32:
+        return sizeof(std::int32_t);
+    case element_type::Uint8:
+        return sizeof(std::uint8_t);
+    }
+    throw std::logic_error("Unreachable code line was reached!");
+}
+
+// Host memory may be unaligned: elements are copied rather than dereferenced
+double var::loadElement(typed_array_t const& arr, size_t index)
+{
+    auto* element = std::get<buffer_t>(*arr.buffer.m_value).data + arr.offset + index * elementSize(arr.type);
+    switch(arr.type){
+    case element_type::Float64: {
+        double value;
+        std::memcpy(&value, element, sizeof(value));
+        return value;
+    }
+    case element_type::Int32: {
+        std::int32_t value;
+        std::memcpy(&value, element, sizeof(value));
+        return value;
+    }
+    case element_type::Uint8:
+        return static_cast<std::uint8_t>(*element);
+    }
+    throw std::logic_error("Unreachable code line was reached!");
+}
+
+/**
+    Integer elements wrap around like the ToInt32 and ToUint8 conversions,
+    NaN and infinities store 0.
+**/
+void var::storeElement(typed_array_t& arr, size_t index, double value)
+{
+    auto* element = std::get<buffer_t>(*arr.buffer.m_value).data + arr.offset + index * elementSize(arr.type);
+    if(arr.type == element_type::Float64){
+        std::memcpy(element, &value, sizeof(value));
+        return;
+    }
+    auto integer = std::isfinite(value) ? static_cast<std::uint32_t>(static_cast<std::int64_t>(std::fmod(std::trunc(value), 4294967296.))) : 0u;
+    if(arr.type == element_type::Int32){
+        auto value32 = static_cast<std::int32_t>(integer);
+        std::memcpy(element, &value32, sizeof(value32));
+        return;
+    }
+    *element = static_cast<std::byte>(integer);
+}
+
+/**
+    The hash of the name is computed once for the whole prototype chain,
+    and kept by the name for the next lookups.
+**/
+auto var::findProperty(object_t& obj, string_t const& propertyName) -> var*
 {
     for(object_t* proto = &obj; proto != nullptr; ){
         if(auto it = proto->properties.find(propertyName);
@@ -236,14 +915,813 @@ auto var::findProperty(object_t& obj, std::string const& propertyName) -> var*
     return nullptr;
 }
 
+auto var::propertyName(var const& property, string_t& storage) -> string_t const&
+{
+    if(property.is_string()){
+        return std::get<string_t>(*property.m_value);
+    }
+    storage = string_t::take(property.to_string());
+    return storage;
+}
+
+
+///Equality
+
+bool var::strict_equals(var const& o) const
+{
+    flatten();
+    o.flatten();
+    if(m_value == o.m_value){
+        // NaN is the only value that differs from itself
+        auto* d = m_value ? std::get_if<double>(&*m_value) : nullptr;
+        return !(d && std::isnan(*d));
+    }
+    if(!m_value || !o.m_value || m_value->index() != o.m_value->index()){
+        return false;
+    }
+    return std::visit([&o](auto&& arg) -> bool{
+        using T = std::decay_t<decltype(arg)>;
+        if constexpr(ISSAME(arg, std::nullptr_t)){
+            return true;
+        } else if constexpr(ISSAME(arg, bool) || ISSAME(arg, double) || ISSAME(arg, string_t)){
+            return arg == std::get<T>(*o.m_value);
+        } else {
+            // Distinct regex, function or object payloads are distinct values
+            return false;
+        }
+    }, *m_value);
+}
+
+bool var::loose_equals(var const& o) const
+{
+    flatten();
+    o.flatten();
+    if(m_value == o.m_value){
+        return strict_equals(o);
+    }
+    auto isNullish = [](var const& v){
+        return !v.m_value || std::holds_alternative<std::nullptr_t>(*v.m_value);
+    };
+    if(isNullish(*this) || isNullish(o)){
+        return isNullish(*this) && isNullish(o);
+    }
+    if(m_value->index() == o.m_value->index()){
+        return strict_equals(o);
+    }
+    auto isPrimitive = [](var const& v){
+        return std::holds_alternative<bool>(*v.m_value)
+            || std::holds_alternative<double>(*v.m_value)
+            || std::holds_alternative<string_t>(*v.m_value);
+    };
+    if(isPrimitive(*this) && isPrimitive(o)){
+        return to_double() == o.to_double();
+    }
+    if(isPrimitive(*this)){
+        return o.loose_equals(*this);
+    }
+    if(isPrimitive(o)){
+        return to_primitive().loose_equals(o);
+    }
+    return false;
+}
+
+var var::to_primitive() const
+{
+    if(auto arr = std::get_if<array_t>(&*m_value)){
+        // Elements joined by commas, holes, null and undefined giving empty strings
+        std::string str;
+        for(size_t i = 0, length = arrayLength(*arr); i < length; ++i){
+            if(i > 0){
+                str += ',';
+            }
+            auto value = loadElement(*arr, i);
+            if(!value.m_value || std::holds_alternative<std::nullptr_t>(*value.m_value)){
+                continue;
+            }
+            if(value.is_string()){
+                str += std::get<string_t>(*value.m_value).view();
+            } else if(std::holds_alternative<array_t>(*value.m_value) || std::holds_alternative<object_t>(*value.m_value)){
+                str += value.to_primitive().to_string();
+            } else {
+                str += value.to_string();
+            }
+        }
+        return string_t::take(std::move(str));
+    }
+    if(auto arr = std::get_if<typed_array_t>(&*m_value)){
+        std::string str;
+        for(size_t i = 0; i < arr->length; ++i){
+            if(i > 0){
+                str += ',';
+            }
+            str += var(loadElement(*arr, i)).to_string();
+        }
+        return string_t::take(std::move(str));
+    }
+    if(std::holds_alternative<object_t>(*m_value)){
+        return "[object Object]";
+    }
+    return var(to_string());
+}
+
+///Concatenation
+
+void var::flatten() const
+{
+    auto rope = m_value ? std::get_if<rope_t>(&*m_value) : nullptr;
+    if(!rope){
+        return;
+    }
+    std::string str;
+    if(rope->buffer.use_count() == 1 && rope->buffer->size() == rope->size){
+        str = std::move(*rope->buffer);
+    } else {
+        str.assign(*rope->buffer, 0, rope->size);
+    }
+    *m_value = string_t::take(std::move(str));
+}
+
+var var::concat(std::string_view left, std::string_view right)
+{
+    if(left.size() + right.size() < ropeMinSize){
+        expectAllocation(left.size() + right.size());
+        std::string str;
+        str.reserve(left.size() + right.size());
+        str.append(left).append(right);
+        return string_t::take(std::move(str));
+    }
+    expectAllocation(2 * (left.size() + right.size()));
+    auto buffer = std::make_shared<std::string>();
+    buffer->reserve(2 * (left.size() + right.size()));
+    buffer->append(left).append(right);
+    var ret;
+    ret.m_value = value_ptr::make(rope_t{buffer, buffer->size()});
+    return ret;
+}
+
+/**
+    The rope is extended in place when it ends its buffer and no other rope shares it,
+    which is the case of a variable appended to repeatedly. Otherwise its start is
+    copied into a new buffer, with room for the next pieces.
+**/
+var var::append(rope_t const& rope, std::string_view piece)
+{
+    std::shared_ptr<std::string> buffer;
+    if(rope.buffer.use_count() == 1 && rope.buffer->size() == rope.size){
+        expectAllocation(rope.size + piece.size());
+        buffer = rope.buffer;
+    } else {
+        expectAllocation(2 * (rope.size + piece.size()));
+        buffer = std::make_shared<std::string>();
+        buffer->reserve(2 * (rope.size + piece.size()));
+        buffer->append(*rope.buffer, 0, rope.size);
+    }
+    buffer->append(piece);
+    var ret;
+    ret.m_value = value_ptr::make(rope_t{buffer, buffer->size()});
+    return ret;
+}
+
+///Cycle collection
+
+namespace {
+
+enum Color : unsigned char
+{
+    Black,
+    Gray,
+    White,
+    Purple,
+};
+
+template<class Node>
+long references(Node* node)
+{
+#if VAR_ATOMIC_REFCOUNT
+    return node->references.load(std::memory_order_relaxed);
+#else
+    return node->references;
+#endif
+}
+
+template<class Node>
+void addReferences(Node* node, long count)
+{
+#if VAR_ATOMIC_REFCOUNT
+    node->references.fetch_add(count, std::memory_order_relaxed);
+#else
+    node->references += count;
+#endif
+}
+
+} // namespace
+
+struct var::collector_t
+{
+    ~collector_t()
+    {
+        for(auto* node : roots){
+            node->buffered = false;
+            if(references(node) == 0){
+                delete node;
+            }
+        }
+    }
+
+    /// Values released while others still referred to them, a cycle may hold them
+    std::vector<node_t*> roots;
+    cycle_stats stats;
+};
+
+auto var::collector() -> collector_t&
+{
+    static thread_local collector_t s_collector;
+    return s_collector;
+}
+
+void var::possibleCycleRoot(node_t* node)
+{
+#if VAR_ATOMIC_REFCOUNT
+    if(node->buffered.exchange(true, std::memory_order_acq_rel)){
+        return;
+    }
+#else
+    node->buffered = true;
+#endif
+    node->color = Purple;
+    collector().roots.push_back(node);
+}
+
+/// The node stays in the roots until the next collection, only its value goes now
+void var::releaseBuffered(node_t* node)
+{
+    node->value.emplace<std::nullptr_t>();
+    recharge(node);
+}
+
+/**
+    Calls f with the nodes the value refers to and which may hold a cycle.
+    A script function also shared by host code, such as a call in progress, is kept
+    alive from outside anyway: its references are not followed.
+**/
+template<class F>
+void var::forEachChild(node_t* node, F f)
+{
+    auto visit = [&f](var const& child){
+        auto* childNode = child.m_value.m_node;
+        if(childNode && !childNode->immortal && mayHoldCycle(childNode->value)){
+            f(childNode);
+        }
+    };
+    std::visit([&visit](auto& value){
+        if constexpr(ISSAME(value, object_t)){
+            visit(value.prototype);
+            for(auto& [name, property] : value.properties){
+                visit(property);
+            }
+        } else if constexpr(ISSAME(value, array_t)){
+            if(auto elements = std::get_if<std::vector<var>>(&value.elements)){
+                for(auto& element : *elements){
+                    visit(element);
+                }
+            } else if(auto sparse = std::get_if<array_t::sparse_t>(&value.elements)){
+                for(auto& [index, element] : sparse->elements){
+                    visit(element);
+                }
+            }
+        } else if constexpr(ISSAME(value, script_function_t)){
+            if(value.use_count() == 1){
+                value->for_each_reference(visit);
+            }
+        }
+    }, node->value);
+}
+
+/**
+    Trial deletion: the references between the values reachable from the roots are
+    subtracted, the values left without references only refer to each other.
+    These are freed, the references of the others are restored.
+**/
+size_t var::collect_cycles()
+{
+    auto& c = collector();
+    auto roots = std::move(c.roots);
+    c.roots.clear();
+    s_allocatedBytes = 0;
+    ++c.stats.collections;
+
+    // Released since they were buffered
+    roots.erase(std::remove_if(roots.begin(), roots.end(), [](node_t* node){
+        if(references(node) == 0){
+            delete node;
+            return true;
+        }
+        return false;
+    }), roots.end());
+
+    std::vector<node_t*> stack;
+    for(auto* node : roots){
+        if(node->color != Gray){
+            node->color = Gray;
+            stack.push_back(node);
+        }
+        while(!stack.empty()){
+            auto* gray = stack.back();
+            stack.pop_back();
+            forEachChild(gray, [&stack](node_t* child){
+                addReferences(child, -1);
+                if(child->color != Gray){
+                    child->color = Gray;
+                    stack.push_back(child);
+                }
+            });
+        }
+    }
+
+    std::vector<node_t*> blackStack;
+    for(auto* root : roots){
+        stack.push_back(root);
+        while(!stack.empty()){
+            auto* node = stack.back();
+            stack.pop_back();
+            if(node->color != Gray){
+                continue;
+            }
+            if(references(node) == 0){
+                node->color = White;
+                forEachChild(node, [&stack](node_t* child){ stack.push_back(child); });
+                continue;
+            }
+            // Referred to from outside: so is everything it reaches
+            node->color = Black;
+            blackStack.push_back(node);
+            while(!blackStack.empty()){
+                auto* black = blackStack.back();
+                blackStack.pop_back();
+                forEachChild(black, [&blackStack](node_t* child){
+                    addReferences(child, 1);
+                    if(child->color != Black){
+                        child->color = Black;
+                        blackStack.push_back(child);
+                    }
+                });
+            }
+        }
+    }
+
+    std::vector<node_t*> garbage;
+    for(auto* root : roots){
+        root->buffered = false;
+        stack.push_back(root);
+        while(!stack.empty()){
+            auto* node = stack.back();
+            stack.pop_back();
+            if(node->color == White){
+                node->color = Black;
+                garbage.push_back(node);
+                forEachChild(node, [&stack](node_t* child){ stack.push_back(child); });
+            }
+        }
+    }
+
+    // Back to real reference counts, plus one so that no value of the cycles
+    // is freed, or buffered, while their values are destroyed
+    for(auto* node : garbage){
+        forEachChild(node, [](node_t* child){ addReferences(child, 1); });
+    }
+    for(auto* node : garbage){
+        addReferences(node, 1);
+        node->buffered = true;
+        c.stats.bytes += memorySize(node);
+    }
+    for(auto* node : garbage){
+        node->value.emplace<std::nullptr_t>();
+    }
+    for(auto* node : garbage){
+        delete node;
+    }
+    c.stats.values += garbage.size();
+    return garbage.size();
+}
+
+auto var::cycle_collector_stats() -> cycle_stats
+{
+    return collector().stats;
+}
+
+///Heap
+
+#if VAR_HEAP
+namespace {
+
+/// Nodes and chunks not owned by any thread
+struct SharedPool
+{
+    std::mutex mutex;
+    void* free = nullptr;
+    /// Lists of heapBatch nodes spilled by the threads, the second word of each first node links the next list
+    void* batches = nullptr;
+    std::atomic<size_t> chunks{0};
+};
+
+SharedPool& sharedPool()
+{
+    // Never destroyed: static vars may release their payload after it would be
+    static auto* s_pool = new SharedPool;
+    return *s_pool;
+}
+
+constexpr size_t chunkSize = 64 * 1024;
+
+void*& nextBatch(void* batch)
+{
+    return static_cast<void**>(batch)[1];
+}
+
+} // namespace
+
+/// Gives the nodes of the thread to the shared pool when it ends
+struct var::heap_guard_t
+{
+    ~heap_guard_t(){ heapRelease(nullptr); }
+};
+
+/**
+    Takes a batch of nodes spilled by another thread, the free nodes left by the threads
+    that ended, or a new chunk.
+**/
+void* var::heapRefill()
+{
+    static thread_local heap_guard_t s_guard;
+    (void)s_guard;
+    auto& heap = s_heap;
+    auto& pool = sharedPool();
+    void* ret = nullptr;
+    {
+        std::lock_guard lock(pool.mutex);
+        if(pool.batches && !heap.released){
+            auto* batch = std::exchange(pool.batches, nextBatch(pool.batches));
+            heap.free = *static_cast<void**>(batch);
+            heap.freeCount = heapBatch - 1;
+            return batch;
+        }
+        if(!pool.free && pool.batches){
+            pool.free = std::exchange(pool.batches, nextBatch(pool.batches));
+        }
+        if(auto* node = pool.free){
+            pool.free = *static_cast<void**>(node);
+            if(!heap.released){
+                heap.free = std::exchange(pool.free, nullptr);
+            }
+            ret = node;
+        }
+    }
+    if(ret){
+        for(auto* node = heap.free; node; node = *static_cast<void**>(node)){
+            ++heap.freeCount;
+        }
+        return ret;
+    }
+    pool.chunks.fetch_add(1, std::memory_order_relaxed);
+    auto* chunk = static_cast<std::byte*>(::operator new(chunkSize));
+    if(heap.released){
+        // Once the thread ends, the rest of the chunk is shared
+        for(auto* node = chunk + sizeof(node_t); node + sizeof(node_t) <= chunk + chunkSize; node += sizeof(node_t)){
+            heapRelease(node);
+        }
+        return chunk;
+    }
+    heap.bump = chunk + sizeof(node_t);
+    heap.end = chunk + chunkSize / sizeof(node_t) * sizeof(node_t);
+    return chunk;
+}
+
+/**
+    Shares a node freed by an ending thread, with no node all the thread has left.
+**/
+void var::heapRelease(void* node) noexcept
+{
+    auto& heap = s_heap;
+    auto& pool = sharedPool();
+    std::lock_guard lock(pool.mutex);
+    if(node){
+        *static_cast<void**>(node) = pool.free;
+        pool.free = node;
+        return;
+    }
+    heap.released = true;
+    for(; heap.bump != heap.end; heap.bump += sizeof(node_t)){
+        *reinterpret_cast<void**>(heap.bump) = std::exchange(heap.free, heap.bump);
+    }
+    while(auto* free = heap.free){
+        heap.free = *static_cast<void**>(free);
+        *static_cast<void**>(free) = pool.free;
+        pool.free = free;
+    }
+    heap.freeCount = 0;
+}
+
+/**
+    Gives heapBatch nodes of the free list of the thread to the shared pool.
+**/
+void var::heapSpill() noexcept
+{
+    auto& heap = s_heap;
+    auto* batch = heap.free;
+    auto* last = batch;
+    for(size_t i = 1; i < heapBatch; ++i){
+        last = *static_cast<void**>(last);
+    }
+    heap.free = std::exchange(*static_cast<void**>(last), nullptr);
+    heap.freeCount -= heapBatch;
+    auto& pool = sharedPool();
+    std::lock_guard lock(pool.mutex);
+    nextBatch(batch) = pool.batches;
+    pool.batches = batch;
+}
+#endif
+
+size_t var::heap_size()
+{
+#if VAR_HEAP
+    return sharedPool().chunks.load(std::memory_order_relaxed) * chunkSize;
+#else
+    return 0;
+#endif
+}
+
+///Memory accounts
+
+/**
+    A string shared by several values or a rope buffer shared by several ropes is
+    counted for each of them, hence the approximation.
+**/
+size_t var::memorySize(node_t const* node)
+{
+    return sizeof(node_t) + std::visit([](auto& value) -> size_t{
+        if constexpr(ISSAME(value, string_t)){
+            return value.heap_size();
+        } else if constexpr(ISSAME(value, rope_t)){
+            return value.size;
+        } else if constexpr(ISSAME(value, object_t)){
+            return value.properties.bucket_count() * sizeof(void*)
+                 + value.properties.size() * (sizeof(*value.properties.begin()) + 2 * sizeof(void*));
+        } else if constexpr(ISSAME(value, array_t)){
+            return std::visit([](auto& elements) -> size_t{
+                if constexpr(ISSAME(elements, array_t::sparse_t)){
+                    return elements.elements.size() * (sizeof(*elements.elements.begin()) + 4 * sizeof(void*));
+                } else {
+                    return elements.capacity() * sizeof(elements[0]);
+                }
+            }, value.elements);
+        } else if constexpr(ISSAME(value, buffer_t)){
+            return value.owner ? value.size : 0;
+        } else if constexpr(ISSAME(value, script_function_t)){
+            return value ? value->memory_size() : 0;
+        } else {
+            return 0;
+        }
+    }, node->value);
+}
+
+void var::charge(node_t* node, memory_account* account)
+{
+    using kind_t = memory_account::kind;
+    auto kind = std::visit([](auto& value){
+        if constexpr(ISSAME(value, string_t) || ISSAME(value, rope_t)){
+            return kind_t::strings;
+        } else if constexpr(ISSAME(value, object_t) || ISSAME(value, array_t)
+                            || ISSAME(value, buffer_t) || ISSAME(value, typed_array_t)){
+            return kind_t::objects;
+        } else if constexpr(ISSAME(value, function_t) || ISSAME(value, script_function_t)){
+            return kind_t::functions;
+        } else {
+            return kind_t::other;
+        }
+    }, node->value);
+    auto size = memorySize(node);
+    account->charge(kind, size);
+    account->m_references.fetch_add(1, std::memory_order_relaxed);
+    node->kind = kind;
+    node->account = account;
+    node->charged = size;
+}
+
+void var::rechargeAccount(node_t* node)
+{
+    auto size = memorySize(node);
+    if(size > node->charged){
+        node->account->charge(node->kind, size - node->charged);
+    } else {
+        node->account->credit(node->kind, node->charged - size);
+    }
+    node->charged = size;
+}
+
+void var::memory_account::expect(size_t bytes) const
+{
+    auto max = limit();
+    if(max && (bytes > max || total() > max - bytes)){
+        throw memory_limit_error("RangeError: Memory limit exceeded");
+    }
+}
+
+void var::memory_account::charge(kind k, size_t bytes)
+{
+    auto total = m_total.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    auto max = limit();
+    if(max && total > max){
+        m_total.fetch_sub(bytes, std::memory_order_relaxed);
+        throw memory_limit_error("RangeError: Memory limit exceeded");
+    }
+    m_bytes[static_cast<size_t>(k)].fetch_add(bytes, std::memory_order_relaxed);
+}
+
+///Copies
+
+var var::cloner::operator()(var const& value)
+{
+    node_t* node = value.m_value.m_node;
+    auto rope = node ? std::get_if<rope_t>(&node->value) : nullptr;
+    auto typedArray = node ? std::get_if<typed_array_t>(&node->value) : nullptr;
+    // A typed array is copied with its buffer
+    auto buffer = node ? std::get_if<buffer_t>(typedArray ? &*typedArray->buffer.m_value : &node->value) : nullptr;
+    bool ownedBytes = buffer && buffer->owned;
+    if(!node || node->immortal || (!rope && !ownedBytes && !mayHoldCycle(node->value))){
+        return value;
+    }
+    if(auto it = m_copies.find(node); it != end(m_copies)){
+        return it->second;
+    }
+    var copy;
+    if(rope){
+        // The original may still grow in place, the copy gets a string of its own
+        copy = var(string_t(std::string_view(*rope->buffer).substr(0, rope->size)));
+    } else if(auto obj = std::get_if<object_t>(&node->value)){
+        copy.m_value = value_ptr::make(object_t{});
+        remember(value, copy);
+        auto& target = std::get<object_t>(*copy.m_value);
+        target.prototype = (*this)(obj->prototype);
+        // The names keep their hash, reserving spares the rehashes
+        target.properties.reserve(obj->properties.size());
+        for(auto& [name, property] : obj->properties){
+            target.properties.emplace(name, (*this)(property));
+        }
+    } else if(auto arr = std::get_if<array_t>(&node->value)){
+        if(auto numbers = std::get_if<std::vector<double>>(&arr->elements)){
+            copy.m_value = value_ptr::make(array_t{*numbers});
+        } else if(auto sparse = std::get_if<array_t::sparse_t>(&arr->elements)){
+            copy.m_value = value_ptr::make(array_t{array_t::sparse_t{{}, sparse->length}});
+            remember(value, copy);
+            auto& target = std::get<array_t::sparse_t>(std::get<array_t>(*copy.m_value).elements).elements;
+            for(auto& [index, element] : sparse->elements){
+                target.emplace_hint(target.end(), index, (*this)(element));
+            }
+        } else {
+            auto& elements = std::get<std::vector<var>>(arr->elements);
+            copy.m_value = value_ptr::make(array_t{std::vector<var>{}});
+            remember(value, copy);
+            auto& target = std::get<std::vector<var>>(std::get<array_t>(*copy.m_value).elements);
+            target.reserve(elements.size());
+            for(auto& element : elements){
+                target.push_back((*this)(element));
+            }
+        }
+    } else if(typedArray){
+        copy = typed_array(typedArray->type, (*this)(typedArray->buffer), typedArray->offset, typedArray->length);
+    } else if(buffer){
+        copy = array_buffer(buffer->size);
+        std::memcpy(copy.data(), buffer->data, buffer->size);
+    } else if(m_copyFunction){
+        copy = m_copyFunction(value, *this);
+    }
+    // A value that may hold a cycle must not be used by two threads, the copies and the originals may be
+    if(copy.m_value.m_node == node || !copy.m_value.m_node){
+        throw std::invalid_argument("var::cloner: a script function would be shared by the copy");
+    }
+    recharge(copy.m_value.m_node);
+    m_copies.emplace(node, copy);
+    return copy;
+}
+
+void var::cloner::remember(var const& original, var copy)
+{
+    m_copies.emplace(original.m_value.m_node, std::move(copy));
+}
+
+///Arithmetic
+
+/**
+    @return the number held by this var if nobody else shares it, nullptr otherwise
+**/
+double* var::unique_double()
+{
+    if(m_value.use_count() != 1){
+        return nullptr;
+    }
+    return std::get_if<double>(&*m_value);
+}
+
+template<class F>
+var& var::update_double(var const& o, F f)
+{
+    if(auto* d = unique_double(); d && o.m_value){
+        if(auto* od = std::get_if<double>(&*o.m_value)){
+            *d = f(*d, *od);
+            return *this;
+        }
+    }
+    return *this = var(f(*this, o));
+}
+
+var& var::operator+=(var const& o)
+{
+    // Appended to itself, a rope is flattened by reading it
+    if(m_value.use_count() == 1 && o.m_value && &o != this){
+        if(auto* rope = std::get_if<rope_t>(&*m_value);
+           rope && rope->buffer.use_count() == 1 && rope->buffer->size() == rope->size){
+            std::string storage;
+            auto piece = o.to_string_view(storage);
+            chargeGrowth(m_value.m_node, piece.size());
+            rope->buffer->append(piece);
+            rope->size = rope->buffer->size();
+            return *this;
+        }
+    }
+    if(auto* d = unique_double(); d && o.m_value){
+        if(auto* od = std::get_if<double>(&*o.m_value)){
+            *d += *od;
+            return *this;
+        }
+    }
+    return *this = *this + o;
+}
+
+var& var::operator-=(var const& o)
+{
+    return update_double(o, [](auto const& a, auto const& b){ return a - b; });
+}
+
+var& var::operator*=(var const& o)
+{
+    return update_double(o, [](auto const& a, auto const& b){ return a * b; });
+}
+
+var& var::operator/=(var const& o)
+{
+    return update_double(o, [](auto const& a, auto const& b){ return a / b; });
+}
+
+var& var::operator%=(var const& o)
+{
+    if(auto* d = unique_double(); d && o.m_value){
+        if(auto* od = std::get_if<double>(&*o.m_value)){
+            *d = std::fmod(*d, *od);
+            return *this;
+        }
+    }
+    return *this = *this % o;
+}
+
+var& var::operator++()
+{
+    if(auto* d = unique_double()){
+        *d += 1.;
+        return *this;
+    }
+    return *this = *this + 1.;
+}
+
+var& var::operator--()
+{
+    if(auto* d = unique_double()){
+        *d -= 1.;
+        return *this;
+    }
+    return *this = *this - 1.;
+}
 
 var operator+(var const& leftHS, var const& rightHS){
     if(!leftHS.m_value || !rightHS.m_value){
         throw undefined_value();
     }
-    if(std::holds_alternative<std::string>(*leftHS.m_value)
-       || std::holds_alternative<std::string>(*rightHS.m_value)){
-        return leftHS.to_string() + rightHS.to_string();
+    auto* ld = std::get_if<double>(&*leftHS.m_value);
+    auto* rd = std::get_if<double>(&*rightHS.m_value);
+    if(ld && rd){
+        return *ld + *rd;
+    }
+    if(std::holds_alternative<var::rope_t>(*leftHS.m_value)){
+        // Read first: the same rope on both sides is flattened by reading it
+        std::string leftStorage, rightStorage;
+        auto right = rightHS.to_string_view(rightStorage);
+        if(auto* lr = std::get_if<var::rope_t>(&*leftHS.m_value)){
+            return var::append(*lr, right);
+        }
+        return var::concat(leftHS.to_string_view(leftStorage), right);
+    }
+    if(leftHS.is_string() || rightHS.is_string()){
+        std::string leftStorage, rightStorage;
+        return var::concat(leftHS.to_string_view(leftStorage), rightHS.to_string_view(rightStorage));
     }
     return leftHS.to_double() + rightHS.to_double();
 }
@@ -252,6 +1730,11 @@ var operator-(var const& leftHS, var const& rightHS){
     if(!leftHS.m_value || !rightHS.m_value){
         throw undefined_value();
     }
+    auto* ld = std::get_if<double>(&*leftHS.m_value);
+    auto* rd = std::get_if<double>(&*rightHS.m_value);
+    if(ld && rd){
+        return *ld - *rd;
+    }
     return leftHS.to_double() - rightHS.to_double();
 }
 
@@ -259,6 +1742,11 @@ var operator*(var const& leftHS, var const& rightHS){
     if(!leftHS.m_value || !rightHS.m_value){
         throw undefined_value();
     }
+    auto* ld = std::get_if<double>(&*leftHS.m_value);
+    auto* rd = std::get_if<double>(&*rightHS.m_value);
+    if(ld && rd){
+        return *ld * *rd;
+    }
     return leftHS.to_double() * rightHS.to_double();
 }
 
@@ -266,6 +1754,11 @@ var operator/(var const& leftHS, var const& rightHS){
     if(!leftHS.m_value || !rightHS.m_value){
         throw undefined_value();
     }
+    auto* ld = std::get_if<double>(&*leftHS.m_value);
+    auto* rd = std::get_if<double>(&*rightHS.m_value);
+    if(ld && rd){
+        return *ld / *rd;
+    }
     return leftHS.to_double() / rightHS.to_double();
 }
 
@@ -273,6 +1766,11 @@ var operator%(var const& leftHS, var const& rightHS){
     if(!leftHS.m_value || !rightHS.m_value){
         throw undefined_value();
     }
+    auto* ld = std::get_if<double>(&*leftHS.m_value);
+    auto* rd = std::get_if<double>(&*rightHS.m_value);
+    if(ld && rd){
+        return std::fmod(*ld, *rd);
+    }
     return std::fmod(leftHS.to_double(), rightHS.to_double());
 }
 
@@ -280,9 +1778,17 @@ bool operator<(var const& leftHS, var const& rightHS){
     if(!leftHS.m_value || !rightHS.m_value){
         throw undefined_value();
     }
-    if(std::holds_alternative<std::string>(*leftHS.m_value)
-       && std::holds_alternative<std::string>(*rightHS.m_value)){
-        return leftHS.to_string() < rightHS.to_string();
+    leftHS.flatten();
+    rightHS.flatten();
+    auto* ld = std::get_if<double>(&*leftHS.m_value);
+    auto* rd = std::get_if<double>(&*rightHS.m_value);
+    if(ld && rd){
+        return *ld < *rd;
+    }
+    auto* ls = std::get_if<var::string_t>(&*leftHS.m_value);
+    auto* rs = std::get_if<var::string_t>(&*rightHS.m_value);
+    if(ls && rs){
+        return *ls < *rs;
     }
     return leftHS.to_double() < rightHS.to_double();
 }
@@ -291,9 +1797,17 @@ bool operator<=(var const& leftHS, var const& rightHS){
     if(!leftHS.m_value || !rightHS.m_value){
         throw undefined_value();
     }
-    if(std::holds_alternative<std::string>(*leftHS.m_value)
-       && std::holds_alternative<std::string>(*rightHS.m_value)){
-        return leftHS.to_string() <= rightHS.to_string();
+    leftHS.flatten();
+    rightHS.flatten();
+    auto* ld = std::get_if<double>(&*leftHS.m_value);
+    auto* rd = std::get_if<double>(&*rightHS.m_value);
+    if(ld && rd){
+        return *ld <= *rd;
+    }
+    auto* ls = std::get_if<var::string_t>(&*leftHS.m_value);
+    auto* rs = std::get_if<var::string_t>(&*rightHS.m_value);
+    if(ls && rs){
+        return *ls <= *rs;
     }
     return leftHS.to_double() <= rightHS.to_double();
 }
@@ -302,9 +1816,17 @@ bool operator>=(var const& leftHS, var const& rightHS){
     if(!leftHS.m_value || !rightHS.m_value){
         throw undefined_value();
     }
-    if(std::holds_alternative<std::string>(*leftHS.m_value)
-       && std::holds_alternative<std::string>(*rightHS.m_value)){
-        return leftHS.to_string() >= rightHS.to_string();
+    leftHS.flatten();
+    rightHS.flatten();
+    auto* ld = std::get_if<double>(&*leftHS.m_value);
+    auto* rd = std::get_if<double>(&*rightHS.m_value);
+    if(ld && rd){
+        return *ld >= *rd;
+    }
+    auto* ls = std::get_if<var::string_t>(&*leftHS.m_value);
+    auto* rs = std::get_if<var::string_t>(&*rightHS.m_value);
+    if(ls && rs){
+        return *ls >= *rs;
     }
     return leftHS.to_double() >= rightHS.to_double();
 }
@@ -1,30 +1,103 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
 #include <unordered_map>
 #include <variant>
 #include <string>
+#include <string_view>
 #include <regex>
+#include <stdexcept>
+#include <array>
+#include <utility>
+#include <functional>
+#include <limits>
+#include <new>
+#include <type_traits>
+#include <thread>
+
+#ifndef VAR_ATOMIC_REFCOUNT
+/// Set to 0 when every var stays on the thread that created it: reference counts are then plain integers
+#define VAR_ATOMIC_REFCOUNT 1
+#endif
+
+#ifndef VAR_HEAP
+/// Set to 0 to allocate each var payload with the global operator new, as memory checkers expect
+#define VAR_HEAP 1
+#endif
 
 class undefined_value{};
 class unavailable_operation{};
+/// A value would take the memory account current on its thread past its limit
+class memory_limit_error: public std::runtime_error
+{
+public:
+    using runtime_error::runtime_error;
+};
+
+class ScriptFunction;
 
 class var
 {
 public:
+    class args_t;
+    class function_t;
+    class string_t;
+    struct string_hash
+    {
+        size_t operator()(string_t const& str) const noexcept;
+    };
+    /// Properties of an object
+    using properties_t = std::unordered_map<string_t, var, string_hash>;
+    /// Element type of a typed array
+    enum class element_type
+    {
+        Float64,
+        Int32,
+        Uint8,
+    };
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
     var() = default;
     var(std::string const& str);
-    var(char const* c_str):var(std::string(c_str)){}
+    var(char const* c_str);
+    // A template so that braced initializers of objects are not taken for a string
+    template<class S, std::enable_if_t<std::is_same_v<S, string_t>, int> = 0>
+    var(S str):m_value(value_ptr::make(std::move(str))){}
     var(std::regex const& rgx);
     var(double d);
     var(bool b);
     var(std::nullptr_t);
-    var(std::function<var(std::vector<var> args)>);
+    var(function_t function);
+    template<class F, std::enable_if_t<!std::is_same_v<std::decay_t<F>, var>
+                                       && std::is_invocable_r_v<var, F&, args_t const&>, int> = 0>
+    var(F function):var(function_t(std::move(function))){}
+    // Host functions taking their arguments by vector are adapted to args_t
+    template<class F, std::enable_if_t<!std::is_same_v<std::decay_t<F>, var>
+                                       && !std::is_invocable_r_v<var, F&, args_t const&>
+                                       && std::is_invocable_r_v<var, F&, std::vector<var>>, int> = 0>
+    var(F function):var(function_t([function = std::move(function)](auto args) mutable -> var{
+        return function(std::vector<var>(args.begin(), args.end()));
+    })){}
+    var(std::shared_ptr<ScriptFunction> function);
     var(std::unordered_map<std::string, var> properties, var prototype = nullptr);
     // Plain function pointers convert to bool if not explicitely overloaded
     template<class T, class...Args>
-    var(T(*lambda)(Args...)):var(std::function<T(Args...)>(lambda)){}
+    var(T(*lambda)(Args...)):var([lambda](auto&&...args)->decltype(lambda(std::forward<decltype(args)>(args)...)){
+        return lambda(std::forward<decltype(args)>(args)...);
+    }){}
 
+    var(var const&) = default;
+    var(var&&) = default;
     var& operator=(var const& o){ m_value = o.m_value; return *this; }
+    var& operator=(var&& o){ m_value = std::move(o.m_value); return *this; }
 
     friend var operator+(var const&, var const&);
     friend var operator-(var const&, var const&);
@@ -37,61 +110,1005 @@ public:
     friend bool operator<=(var const&, var const&);
     friend bool operator>=(var const&, var const&);
 
-    var& operator+=(var const& o){ return *this = *this + o; }
-    var& operator-=(var const& o){ return *this = *this - o; }
-    var& operator*=(var const& o){ return *this = *this * o; }
-    var& operator/=(var const& o){ return *this = *this / o; }
-    var& operator%=(var const& o){ return *this = *this % o; }
-    var& operator++(){ return *this = *this + 1.; }
-    var& operator--(){ return *this = *this - 1.; }
+    // Update the value in place when this var is its only owner
+    var& operator+=(var const& o);
+    var& operator-=(var const& o);
+    var& operator*=(var const& o);
+    var& operator/=(var const& o);
+    var& operator%=(var const& o);
+    var& operator++();
+    var& operator--();
     var operator++(int){ auto old = *this; ++(*this); return old; }
     var operator--(int){ auto old = *this; --(*this); return old; }
 
+    /// ===, objects and functions are equal only to themselves
+    bool strict_equals(var const& o) const;
+    /// ==, converts to number or string where the types differ
+    bool loose_equals(var const& o) const;
+    /// !== and != counterparts, usable where a function pointer is expected
+    template<bool(var::*equals)(var const&) const>
+    static bool differs(var const& a, var const& b){ return !(a.*equals)(b); }
+
     bool is_undefined() const;
     bool is_null() const;
+    bool is_string() const;
     bool is_callable() const;
+    bool is_array() const;
+    /// An array which only stores the elements set past a hole too large to fill
+    bool is_sparse_array() const;
+    bool is_array_buffer() const;
+    bool is_typed_array() const;
+    /// The function if it was written in script, nullptr otherwise
+    ScriptFunction* script_function() const;
 
     std::string to_string() const;
+    /// The characters of a string value without copy, other values are converted into `storage`
+    std::string_view to_string_view(std::string& storage) const;
+    /// The value as a property name, a string value is shared rather than copied
+    string_t to_key() const;
     std::regex to_regex() const;
     double to_double() const;
     bool to_bool() const;
+    /**
+        Replaces a rope by the string it holds, any observation of the content starts with it.
+        A rope grows and flattens in place: values shared with other threads are flattened first.
+    **/
+    void flatten() const;
 
-    var operator()(std::vector<var> args = {});
+    var operator()(args_t args);
+    var operator()(std::vector<var> const& args = {});
     var& operator[](var property);
-    var& operator[](char const* property){ return operator[](var(property)); };
-    var const& operator[](var property) const;
-    var const& operator[](char const* property) const { return operator[](var(property)); };
+    var& operator[](string_t const& property);
+    var& operator[](char const* property);
+    /// By value: the elements of a packed array are numbers, only boxed when read
+    var operator[](var property) const;
+    var const& operator[](string_t const& property) const;
+    var operator[](char const* property) const;
+    /// The object of the prototype chain holding the property, undefined if none does
+    var const& property_owner(string_t const& property) const;
+    /**
+        Reads the property by value, including the computed ones such as an array length.
+        Unlike operator[] it never creates the property.
+    **/
+    var get(var const& property) const;
+    /// Stores the property, an array keeps its numbers packed when given a number
+    void set(var const& property, var value);
 
     static const var undefined;
 
+    struct cycle_stats
+    {
+        size_t collections = 0;
+        /// Values freed by the collections
+        size_t values = 0;
+        /// Approximate memory of these values and of their elements
+        size_t bytes = 0;
+    };
+    /**
+        Frees the reference cycles among the objects, arrays and script functions released
+        on this thread since the last collection. Host functions are opaque: what they capture
+        is never collected. No other thread may use these values meanwhile.
+        @return the number of values freed
+    **/
+    static size_t collect_cycles();
+    /// Whether this thread created enough values since the last collection to run one
+    static bool cycle_collection_due(){ return s_allocatedBytes >= s_collectionThreshold; }
+    /// Bytes of new values that make a collection due, 4 MiB by default
+    static void set_cycle_collection_threshold(size_t bytes){ s_collectionThreshold = bytes; }
+    /// Totals of the collections of this thread
+    static cycle_stats cycle_collector_stats();
+    /// Bytes the payloads of all threads took from the system, 0 with VAR_HEAP=0
+    static size_t heap_size();
+
+    class memory_account;
+    class cloner;
+
+    /// Object, the properties are moved in without rehashing their names
+    static var object(properties_t properties, var prototype = nullptr);
+    /// Array, packed as numbers when every element is one
+    static var array(std::vector<var> elements = {});
+    static var array(std::vector<double> numbers);
+    /// Zero filled ArrayBuffer of `size` bytes
+    static var array_buffer(size_t size);
+    /// ArrayBuffer over host memory, without copy: `owner` keeps it alive if the host does not
+    static var array_buffer(void* data, size_t size, std::shared_ptr<void> owner = {});
+    /// Typed array viewing the ArrayBuffer from `offset` bytes, up to its end if `length` is npos
+    static var typed_array(element_type type, var buffer, size_t offset = 0, size_t length = npos);
+    /// Typed array over a new zero filled ArrayBuffer
+    static var typed_array(element_type type, size_t length);
+    /// Memory of an ArrayBuffer or typed array, nullptr for any other value
+    std::byte* data() const;
+    size_t byte_length() const;
+    /// Elements of a packed array or aligned Float64 typed array, nullptr for any other value
+    double* packed_numbers(size_t& size) const;
+
+    /**
+        Host function with typed parameters and result, converted at compile time.
+        Parameters can be var, bool, arithmetic types, std::string or std::string_view,
+        a std::string_view refers to the argument itself when it already is a string.
+        Integers wrap around as with the ToInt32 of JavaScript, NaN and infinities give 0.
+    **/
+    template<auto function>
+    static var bind();
+    template<class R, class...Args>
+    static var bind(R(*function)(Args...));
+
 private:
-    using function_t = std::function<var(std::vector<var> args)>;
+    template<class R, class...Args>
+    static var invoke(R(*function)(Args...), args_t args);
+    template<class R, class...Args, size_t...I>
+    static var invoke(R(*function)(Args...), args_t args, std::index_sequence<I...>);
+    template<class T>
+    static decltype(auto) convert_argument(var const& v, std::string& storage);
+    template<class I>
+    static I convert_integer(double d);
+    template<class T>
+    static var convert_result(T&& result);
+
+    using script_function_t = std::shared_ptr<ScriptFunction>;
 
     template<class T>
     struct objectT
     {
         T prototype;
-        std::unordered_map<std::string, T> properties;
+        std::unordered_map<string_t, T, string_hash> properties;
     };
     using object_t = objectT<var>;
 
+    template<class T>
+    struct arrayT
+    {
+        /// Elements stored far past the end, the holes in between take no memory
+        struct sparse_t
+        {
+            std::map<size_t, T> elements;
+            size_t length = 0;
+        };
+        /// Numbers stay unboxed until an element of another type is stored,
+        /// an array turned sparse stays so
+        std::variant<std::vector<double>, std::vector<T>, sparse_t> elements;
+    };
+    using array_t = arrayT<var>;
+
+    struct buffer_t
+    {
+        std::byte* data;
+        size_t size;
+        /// Empty when the host keeps the memory alive
+        std::shared_ptr<void> owner;
+        /// Allocated by array_buffer(size) rather than given by the host, a clone copies the bytes
+        bool owned = false;
+    };
+
+    template<class T>
+    struct typedArrayT
+    {
+        /// The ArrayBuffer
+        T buffer;
+        element_type type;
+        size_t offset;
+        size_t length;
+    };
+    using typed_array_t = typedArrayT<var>;
+
+    /// String built by concatenation, appending at the end of the buffer needs no copy
+    struct rope_t
+    {
+        std::shared_ptr<std::string> buffer;
+        /// The string is the start of the buffer, a longer rope may share the rest
+        size_t size;
+    };
+    /// Concatenations shorter than this give a plain string
+    static constexpr size_t ropeMinSize = 256;
+
     using var_t = std::variant<
         std::nullptr_t,
         bool,
         double,
-        std::string,
+        string_t,
         std::regex,
         function_t,
-        object_t>;
+        script_function_t,
+        object_t,
+        array_t,
+        buffer_t,
+        typed_array_t,
+        rope_t>;
+
+    struct node_t;
+
+    /// Owner of the payload, counting its references in the payload itself
+    class value_ptr
+    {
+    public:
+        value_ptr() noexcept = default;
+        value_ptr(value_ptr const& o) noexcept;
+        value_ptr(value_ptr&& o) noexcept: m_node(std::exchange(o.m_node, nullptr)){}
+        value_ptr& operator=(value_ptr const& o) noexcept { value_ptr(o).swap(*this); return *this; }
+        value_ptr& operator=(value_ptr&& o) noexcept { value_ptr(std::move(o)).swap(*this); return *this; }
+        ~value_ptr();
+
+        template<class...Args>
+        static value_ptr make(Args&&...args);
+
+        explicit operator bool() const noexcept { return m_node; }
+        var_t& operator*() const noexcept { return *get(); }
+        var_t* operator->() const noexcept { return get(); }
+        var_t* get() const noexcept;
+        long use_count() const noexcept;
+        /// The payload is never destroyed and its references are not counted, any thread may share it
+        value_ptr& make_immortal() noexcept;
+
+        void swap(value_ptr& o) noexcept { std::swap(m_node, o.m_node); }
+        friend bool operator==(value_ptr const& a, value_ptr const& b) noexcept { return a.m_node == b.m_node; }
+        friend bool operator!=(value_ptr const& a, value_ptr const& b) noexcept { return a.m_node != b.m_node; }
+
+    private:
+        friend class var;
+
+        node_t* m_node = nullptr;
+    };
+
+    value_ptr m_value;
+
+    struct collector_t;
+    static collector_t& collector();
+    static inline thread_local size_t s_allocatedBytes = 0;
+    static inline thread_local size_t s_collectionThreshold = 4 << 20;
+    static bool mayHoldCycle(var_t const& value);
+    static void possibleCycleRoot(node_t* node);
+    static void releaseBuffered(node_t* node);
+    template<class F>
+    static void forEachChild(node_t* node, F f);
+
+    /**
+        Memory of the payloads of this thread: nodes are taken by bumping a pointer in
+        64 KiB chunks and recycled through a free list, without going through malloc.
+        Chunks are never given back, a thread that ends leaves its free nodes to the others.
+        A node goes to the free list of the thread freeing it: past heapSpillCount free nodes,
+        a batch of them goes to the shared pool, where the threads allocating take them back.
+    **/
+    struct heap_t
+    {
+        /// Free nodes, each starts with the address of the next one
+        void* free;
+        size_t freeCount;
+        std::byte* bump;
+        std::byte* end;
+        /// The thread is ending: its nodes go straight to the shared pool
+        bool released;
+    };
+    static constexpr size_t heapBatch = 512;
+    static constexpr size_t heapSpillCount = 2 * heapBatch;
+    /// Zero initialized, like any thread_local
+    static inline thread_local heap_t s_heap;
+    struct heap_guard_t;
+    static void* heapRefill();
+    static void heapRelease(void* node) noexcept;
+    static void heapSpill() noexcept;
+
+    /// Approximate memory of the node and of what its value owns
+    static size_t memorySize(node_t const* node);
+    static void charge(node_t* node, memory_account* account);
+    /// Charges the growth of an object or array to the account of its creation
+    static void recharge(node_t* node);
+    static void rechargeAccount(node_t* node);
+    static void chargeGrowth(node_t* node, size_t bytes);
+    static void expectAllocation(size_t bytes);
+    template<class E>
+    static void chargeGrowth(node_t* node, std::vector<E> const& elements, size_t size);
+
+    static var* findProperty(object_t& obj, string_t const& propertyName);
+    /// The string held by the property, or its conversion stored in `storage`
+    static string_t const& propertyName(var const& property, string_t& storage);
+    static std::vector<var>& unpack(array_t& arr);
+    static bool arrayIndex(var const& property, size_t& index);
+    static size_t arrayLength(array_t const& arr);
+    static var loadElement(array_t const& arr, size_t index);
+    static var& element(node_t* node, size_t index);
+    static void storeElement(node_t* node, size_t index, var value);
+    static void resizeElements(node_t* node, size_t length);
+    static void makeSparse(array_t& arr);
+    static size_t elementSize(element_type type);
+    static double loadElement(typed_array_t const& arr, size_t index);
+    static void storeElement(typed_array_t& arr, size_t index, double value);
+
+    /// The primitive an object or array stands for in a loose comparison, the value itself otherwise
+    var to_primitive() const;
+
+    static var concat(std::string_view left, std::string_view right);
+    static var append(rope_t const& rope, std::string_view piece);
+
+    /// Static values, any interpreter on any thread may use them
+    /// Shared by the whole process: made while no memory account is current, none pays for it
+    template<class F>
+    static var immortal(F make);
+
+    double* unique_double();
+    template<class F>
+    var& update_double(var const& o, F f);
+};
+
+/// Arguments of a call: a view over values owned by the caller, and the `this` value
+class var::args_t
+{
+public:
+    args_t(var const* data, size_t size, var const* self = nullptr): m_data(data), m_size(size), m_self(self){}
+    args_t(std::vector<var> const& args, var const* self = nullptr): args_t(args.data(), args.size(), self){}
+
+    var const* begin() const { return m_data; }
+    var const* end() const { return m_data + m_size; }
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    /// Missing arguments are undefined
+    var const& operator[](size_t i) const { return i < m_size ? m_data[i] : undefined; }
+    var const& self() const { return m_self ? *m_self : undefined; }
+
+private:
+    var const* m_data;
+    size_t m_size;
+    var const* m_self;
+};
+
+/**
+    Immutable string, the string values and the property names of a var. Strings up to
+    15 characters are stored inline, longer ones share a reference counted block so
+    copies never copy the characters. The hash is computed at the first lookup and kept.
+**/
+class var::string_t
+{
+public:
+    string_t() noexcept: m_size(0){ m_inline[0] = '\0'; }
+    string_t(std::string_view str): m_size(str.size())
+    {
+        if(isInline()){
+            std::memcpy(m_inline, str.data(), m_size);
+            m_inline[m_size] = '\0';
+        } else {
+            m_block = new Block(std::string(str));
+        }
+    }
+    string_t(char const* c_str): string_t(std::string_view(c_str)){}
+    string_t(string_t const& o) noexcept:
+        m_size(o.m_size),
+        m_hash(o.m_hash.load(std::memory_order_relaxed))
+    {
+        if(isInline()){
+            std::memcpy(m_inline, o.m_inline, m_size + 1);
+        } else {
+            m_block = o.m_block;
+            m_block->references.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    string_t(string_t&& o) noexcept:
+        m_size(o.m_size),
+        m_hash(o.m_hash.load(std::memory_order_relaxed))
+    {
+        if(isInline()){
+            std::memcpy(m_inline, o.m_inline, m_size + 1);
+        } else {
+            m_block = o.m_block;
+            o.m_size = 0;
+            o.m_inline[0] = '\0';
+            o.m_hash.store(0, std::memory_order_relaxed);
+        }
+    }
+    string_t& operator=(string_t const& o) noexcept { if(this != &o){ this->~string_t(); ::new(this) string_t(o); } return *this; }
+    string_t& operator=(string_t&& o) noexcept { if(this != &o){ this->~string_t(); ::new(this) string_t(std::move(o)); } return *this; }
+    ~string_t()
+    {
+        if(!isInline() && m_block->references.fetch_sub(1, std::memory_order_acq_rel) == 1){
+            delete m_block;
+        }
+    }
+    /// Long strings keep the buffer of `str` rather than copying it
+    static string_t take(std::string&& str)
+    {
+        string_t ret;
+        ret.m_size = str.size();
+        if(ret.isInline()){
+            std::memcpy(ret.m_inline, str.data(), ret.m_size + 1);
+        } else {
+            ret.m_block = new Block(std::move(str));
+        }
+        return ret;
+    }
+
+    std::string_view view() const noexcept { return {data(), m_size}; }
+    operator std::string_view() const noexcept { return view(); }
+    /// Null terminated
+    char const* data() const noexcept { return isInline() ? m_inline : m_block->str.data(); }
+    size_t size() const noexcept { return m_size; }
+    bool empty() const noexcept { return m_size == 0; }
+
+    /// std::hash of the characters, a hash of 0 is not kept
+    size_t hash() const noexcept
+    {
+        auto h = m_hash.load(std::memory_order_relaxed);
+        if(h == 0){
+            h = std::hash<std::string_view>{}(view());
+            m_hash.store(h, std::memory_order_relaxed);
+        }
+        return h;
+    }
+
+    friend bool operator==(string_t const& a, string_t const& b) noexcept
+    {
+        if(a.m_size != b.m_size){
+            return false;
+        }
+        auto ha = a.m_hash.load(std::memory_order_relaxed);
+        auto hb = b.m_hash.load(std::memory_order_relaxed);
+        if(ha != 0 && hb != 0 && ha != hb){
+            return false;
+        }
+        return std::memcmp(a.data(), b.data(), a.m_size) == 0;
+    }
+    friend bool operator!=(string_t const& a, string_t const& b) noexcept { return !(a == b); }
+    friend bool operator<(string_t const& a, string_t const& b) noexcept { return a.view() < b.view(); }
+    friend bool operator<=(string_t const& a, string_t const& b) noexcept { return a.view() <= b.view(); }
+    friend bool operator>=(string_t const& a, string_t const& b) noexcept { return a.view() >= b.view(); }
+
+    /// Memory of the characters outside of the string, shared by its copies
+    size_t heap_size() const noexcept { return isInline() ? 0 : sizeof(Block) + m_size + 1; }
+
+private:
+    static constexpr size_t inlineCapacity = 15;
+
+    struct Block
+    {
+        explicit Block(std::string&& characters): str(std::move(characters)){}
+
+        std::atomic<size_t> references{1};
+        std::string str;
+    };
+
+    bool isInline() const noexcept { return m_size <= inlineCapacity; }
+
+    size_t m_size;
+    mutable std::atomic<size_t> m_hash{0};
+    union
+    {
+        char m_inline[inlineCapacity + 1];
+        Block* m_block;
+    };
+};
+
+inline size_t var::string_hash::operator()(string_t const& str) const noexcept
+{
+    return str.hash();
+}
+
+inline std::ostream& operator<<(std::ostream& os, var::string_t const& str)
+{
+    return os << str.view();
+}
+
+/**
+    Host function. Callables up to three pointers large, such as a lambda capturing
+    a function pointer or a few references, are stored inline; larger ones are
+    allocated on the heap.
+**/
+class var::function_t
+{
+public:
+    function_t() noexcept = default;
+    function_t(std::nullptr_t) noexcept {}
+    template<class F, std::enable_if_t<!std::is_same_v<std::decay_t<F>, function_t>
+                                       && std::is_invocable_r_v<var, std::decay_t<F>&, args_t const&>, int> = 0>
+    function_t(F&& function)
+    {
+        using T = std::decay_t<F>;
+        if constexpr(isInline<T>){
+            ::new(static_cast<void*>(&m_storage)) T(std::forward<F>(function));
+        } else {
+            ::new(static_cast<void*>(&m_storage)) T*(new T(std::forward<F>(function)));
+        }
+        m_operations = &s_operations<T>;
+    }
+    function_t(function_t const& o):
+        m_operations(o.m_operations)
+    {
+        if(m_operations)
+            m_operations->copy(o.m_storage, m_storage);
+    }
+    function_t(function_t&& o) noexcept:
+        m_operations(std::exchange(o.m_operations, nullptr))
+    {
+        if(m_operations)
+            m_operations->move(o.m_storage, m_storage);
+    }
+    function_t& operator=(function_t const& o){ if(this != &o) *this = function_t(o); return *this; }
+    function_t& operator=(function_t&& o) noexcept
+    {
+        if(this != &o){
+            reset();
+            m_operations = std::exchange(o.m_operations, nullptr);
+            if(m_operations)
+                m_operations->move(o.m_storage, m_storage);
+        }
+        return *this;
+    }
+    ~function_t(){ reset(); }
+
+    explicit operator bool() const noexcept { return m_operations; }
+    var operator()(args_t args) const;
+
+private:
+    static constexpr size_t inlineSize = 3 * sizeof(void*);
+    using storage_t = std::aligned_storage_t<inlineSize, alignof(void*)>;
+
+    template<class T>
+    static constexpr bool isInline = sizeof(T) <= inlineSize && alignof(T) <= alignof(void*)
+                                     && std::is_nothrow_move_constructible_v<T>;
+
+    struct Operations
+    {
+        var(*call)(storage_t& storage, args_t args);
+        void(*copy)(storage_t const& from, storage_t& to);
+        /// Leaves `from` destroyed
+        void(*move)(storage_t& from, storage_t& to) noexcept;
+        void(*destroy)(storage_t& storage) noexcept;
+    };
+
+    template<class T>
+    static T& target(storage_t& storage)
+    {
+        if constexpr(isInline<T>){
+            return *std::launder(reinterpret_cast<T*>(&storage));
+        } else {
+            return **std::launder(reinterpret_cast<T**>(&storage));
+        }
+    }
+    template<class T>
+    static T const& target(storage_t const& storage){ return target<T>(const_cast<storage_t&>(storage)); }
 
-    std::shared_ptr<var_t> m_value;
+    template<class T>
+    static inline constexpr Operations s_operations{
+        [](storage_t& storage, args_t args)->var{ return std::invoke(target<T>(storage), args); },
+        [](storage_t const& from, storage_t& to){
+            if constexpr(isInline<T>){
+                ::new(static_cast<void*>(&to)) T(target<T>(from));
+            } else {
+                ::new(static_cast<void*>(&to)) T*(new T(target<T>(from)));
+            }
+        },
+        [](storage_t& from, storage_t& to) noexcept {
+            if constexpr(isInline<T>){
+                ::new(static_cast<void*>(&to)) T(std::move(target<T>(from)));
+                target<T>(from).~T();
+            } else {
+                ::new(static_cast<void*>(&to)) T*(&target<T>(from));
+            }
+        },
+        [](storage_t& storage) noexcept {
+            if constexpr(isInline<T>){
+                target<T>(storage).~T();
+            } else {
+                delete &target<T>(storage);
+            }
+        }
+    };
+
+    void reset() noexcept
+    {
+        if(m_operations)
+            std::exchange(m_operations, nullptr)->destroy(m_storage);
+    }
 
-    static var* findProperty(object_t& obj, std::string const& propertyName);
+    Operations const* m_operations = nullptr;
+    mutable storage_t m_storage;
+};
+
+inline var var::function_t::operator()(args_t args) const
+{
+    if(!m_operations)
+        throw std::bad_function_call();
+    return m_operations->call(m_storage, args);
+}
+
+/**
+    Memory of the values created while the account is current on their thread, sorted by
+    kind, until they are destroyed on any thread. Objects and arrays are charged again
+    when they grow. A charge past the limit throws memory_limit_error.
+**/
+class var::memory_account
+{
+public:
+    enum class kind: unsigned char
+    {
+        strings,
+        objects,
+        functions,
+        other,
+        parse_trees,
+    };
+    static constexpr size_t kinds = 5;
+
+    /// The account lives until its owner releases it and the values charged to it are destroyed
+    static memory_account* create(){ return new memory_account(); }
+    void release() noexcept
+    {
+        if(m_references.fetch_sub(1, std::memory_order_acq_rel) == 1){
+            delete this;
+        }
+    }
+
+    size_t bytes(kind k) const { return m_bytes[static_cast<size_t>(k)].load(std::memory_order_relaxed); }
+    size_t total() const { return m_total.load(std::memory_order_relaxed); }
+    /// 0 when there is none
+    size_t limit() const { return m_limit.load(std::memory_order_relaxed); }
+    void set_limit(size_t bytes){ m_limit.store(bytes, std::memory_order_relaxed); }
+
+    /// Charges memory held outside of the values, such as parse trees
+    void charge(kind k, size_t bytes);
+    /// Throws memory_limit_error if the bytes would not fit in the limit, to check before allocating them
+    void expect(size_t bytes) const;
+    void credit(kind k, size_t bytes) noexcept
+    {
+        m_total.fetch_sub(bytes, std::memory_order_relaxed);
+        m_bytes[static_cast<size_t>(k)].fetch_sub(bytes, std::memory_order_relaxed);
+    }
+
+    /// The account charged for the values created on this thread, if any
+    static memory_account* current(){ return s_current; }
+
+    /// Makes the account current on this thread until the end of the scope
+    class scope
+    {
+    public:
+        explicit scope(memory_account* account): m_previous(std::exchange(s_current, account)){}
+        ~scope(){ s_current = m_previous; }
+        scope(scope const&) = delete;
+        scope& operator=(scope const&) = delete;
+
+    private:
+        memory_account* m_previous;
+    };
+
+private:
+    friend class var;
+
+    memory_account() = default;
+
+    std::atomic<size_t> m_bytes[kinds] = {};
+    std::atomic<size_t> m_total{0};
+    std::atomic<size_t> m_limit{0};
+    /// The owner and each value charged
+    std::atomic<long> m_references{1};
+    static inline thread_local memory_account* s_current = nullptr;
+};
+
+/**
+    Copies object graphs: each object and array reached is copied once, so that the copies
+    share and loop as the originals do. Ropes, which grow in place, are copied as strings.
+    ArrayBuffers and typed arrays are copied with their bytes, unless the host provided the
+    memory. The other values are immutable or belong to the host, they are shared. Script functions
+    may hold cycles, which one thread at a time only can use: the function copier must copy
+    them, and remember() its copy before copying the values the function references.
+    The originals are only read, several threads may copy the same graph at once.
+**/
+class var::cloner
+{
+public:
+    using function_copier = std::function<var(var const& function, cloner& clone)>;
+
+    explicit cloner(function_copier copyFunction = {}): m_copyFunction(std::move(copyFunction)){}
+
+    var operator()(var const& value);
+    void remember(var const& original, var copy);
+
+private:
+    function_copier m_copyFunction;
+    std::unordered_map<node_t const*, var> m_copies;
+};
+
+struct var::node_t
+{
+    template<class...Args>
+    explicit node_t(Args&&...args): value(std::forward<Args>(args)...){}
+    ~node_t()
+    {
+        if(account){
+            account->credit(kind, charged);
+            account->release();
+        }
+    }
+
+#if VAR_ATOMIC_REFCOUNT
+    std::atomic<long> references{1};
+#else
+    long references = 1;
+#endif
+    bool immortal = false;
+    /**
+        In the possible roots of the cycle collector of one thread. Threads releasing references
+        at once may race to buffer the node, only one of them does. The values that may hold a
+        cycle are used by one thread at a time otherwise: color belongs to the collector.
+    **/
+#if VAR_ATOMIC_REFCOUNT
+    std::atomic<bool> buffered{false};
+#else
+    bool buffered = false;
+#endif
+    unsigned char color = 0;
+    memory_account::kind kind = memory_account::kind::other;
+    /// Where the value was charged, and the bytes charged
+    memory_account* account = nullptr;
+    size_t charged = 0;
+#if !VAR_ATOMIC_REFCOUNT && !defined(NDEBUG)
+    std::thread::id thread = std::this_thread::get_id();
+#endif
+    var_t value;
+
+#if VAR_HEAP
+    static void* operator new(size_t size);
+    static void operator delete(void* node) noexcept;
+#endif
+};
+
+#if VAR_HEAP
+inline void* var::node_t::operator new([[maybe_unused]] size_t size)
+{
+    assert(size == sizeof(node_t));
+    auto& heap = s_heap;
+    if(auto* node = heap.free){
+        heap.free = *static_cast<void**>(node);
+        --heap.freeCount;
+        return node;
+    }
+    if(heap.bump != heap.end){
+        return std::exchange(heap.bump, heap.bump + sizeof(node_t));
+    }
+    return heapRefill();
+}
+
+inline void var::node_t::operator delete(void* node) noexcept
+{
+    auto& heap = s_heap;
+    if(heap.released){
+        return heapRelease(node);
+    }
+    *static_cast<void**>(node) = heap.free;
+    heap.free = node;
+    if(++heap.freeCount > heapSpillCount){
+        heapSpill();
+    }
+}
+#endif
+
+inline void var::recharge(node_t* node)
+{
+    if(node->account){
+        rechargeAccount(node);
+    }
+}
+
+/// Charged before the allocation, so that the limit holds however much it grows, recharge() settles the estimate
+inline void var::chargeGrowth(node_t* node, size_t bytes)
+{
+    if(node->account){
+        node->account->charge(node->kind, bytes);
+        node->charged += bytes;
+    }
+}
+
+/// For a value about to be created, charged once it is
+inline void var::expectAllocation(size_t bytes)
+{
+    if(auto* account = memory_account::current()){
+        account->expect(bytes);
+    }
+}
+
+/// Growing past the capacity allocates at least twice the capacity
+template<class E>
+void var::chargeGrowth(node_t* node, std::vector<E> const& elements, size_t size)
+{
+    if(size > elements.capacity()){
+        chargeGrowth(node, (std::max(size, 2 * elements.capacity()) - elements.capacity()) * sizeof(E));
+    }
+}
+
+/// Only the values that hold other values can be part of a cycle
+inline bool var::mayHoldCycle(var_t const& value)
+{
+    return std::holds_alternative<object_t>(value)
+        || std::holds_alternative<array_t>(value)
+        || std::holds_alternative<script_function_t>(value);
+}
+
+#if !VAR_ATOMIC_REFCOUNT && !defined(NDEBUG)
+    #define VAR_ASSERT_SAME_THREAD(node) \
+        assert((node)->thread == std::this_thread::get_id() && "var shared between threads, build with VAR_ATOMIC_REFCOUNT=1")
+#else
+    #define VAR_ASSERT_SAME_THREAD(node) ((void)0)
+#endif
+
+inline var::value_ptr::value_ptr(value_ptr const& o) noexcept:
+    m_node(o.m_node)
+{
+    if(m_node && !m_node->immortal){
+        VAR_ASSERT_SAME_THREAD(m_node);
+#if VAR_ATOMIC_REFCOUNT
+        m_node->references.fetch_add(1, std::memory_order_relaxed);
+#else
+        ++m_node->references;
+#endif
+    }
+}
+
+inline var::value_ptr::~value_ptr()
+{
+    if(m_node && !m_node->immortal){
+        VAR_ASSERT_SAME_THREAD(m_node);
+        // Buffered before the release: past it, another thread may free the node
+        if(!m_node->buffered && mayHoldCycle(m_node->value) && use_count() > 1){
+            possibleCycleRoot(m_node);
+        }
+#if VAR_ATOMIC_REFCOUNT
+        if(m_node->references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+#else
+        if(--m_node->references == 0)
+#endif
+        {
+            if(m_node->buffered){
+                releaseBuffered(m_node);
+            } else {
+                delete m_node;
+            }
+        }
+    }
+}
+
+#undef VAR_ASSERT_SAME_THREAD
+
+template<class...Args>
+auto var::value_ptr::make(Args&&...args) -> value_ptr
+{
+    value_ptr ret;
+    ret.m_node = new node_t(std::forward<Args>(args)...);
+    s_allocatedBytes += sizeof(node_t);
+    if(auto* account = memory_account::current()){
+        charge(ret.m_node, account);
+    }
+    return ret;
+}
+
+inline auto var::value_ptr::get() const noexcept -> var_t*
+{
+    return m_node ? &m_node->value : nullptr;
+}
+
+inline long var::value_ptr::use_count() const noexcept
+{
+    if(!m_node){
+        return 0;
+    }
+#if VAR_ATOMIC_REFCOUNT
+    return m_node->references.load(std::memory_order_relaxed);
+#else
+    return m_node->references;
+#endif
+}
+
+inline auto var::value_ptr::make_immortal() noexcept -> value_ptr&
+{
+    if(m_node){
+        m_node->immortal = true;
+    }
+    return *this;
+}
+
+template<class F>
+var var::immortal(F make)
+{
+    memory_account::scope none(nullptr);
+    var ret = make();
+    ret.m_value.make_immortal();
+    return ret;
+}
+
+template<auto function>
+var var::bind()
+{
+    return function_t([](args_t args){ return invoke(function, args); });
+}
+
+template<class R, class...Args>
+var var::bind(R(*function)(Args...))
+{
+    return function_t([function](args_t args){ return invoke(function, args); });
+}
+
+template<class R, class...Args>
+var var::invoke(R(*function)(Args...), args_t args)
+{
+    return invoke(function, args, std::index_sequence_for<Args...>{});
+}
+
+template<class R, class...Args, size_t...I>
+var var::invoke(R(*function)(Args...), args_t args, std::index_sequence<I...>)
+{
+    // Backing strings of the std::string_view parameters that needed a conversion
+    [[maybe_unused]] std::array<std::string, sizeof...(Args)> storage;
+    if constexpr(std::is_void_v<R>){
+        function(convert_argument<Args>(args[I], storage[I])...);
+        return undefined;
+    } else {
+        return convert_result(function(convert_argument<Args>(args[I], storage[I])...));
+    }
+}
+
+template<class T>
+decltype(auto) var::convert_argument(var const& v, [[maybe_unused]] std::string& storage)
+{
+    using U = std::remove_cv_t<std::remove_reference_t<T>>;
+    if constexpr(std::is_same_v<U, var>){
+        return (v);
+    } else if constexpr(std::is_same_v<U, bool>){
+        return v.to_bool();
+    } else if constexpr(std::is_integral_v<U>){
+        return convert_integer<U>(v.to_double());
+    } else if constexpr(std::is_arithmetic_v<U>){
+        return static_cast<U>(v.to_double());
+    } else if constexpr(std::is_same_v<U, std::string>){
+        return v.to_string();
+    } else if constexpr(std::is_same_v<U, std::string_view>){
+        return v.to_string_view(storage);
+    } else {
+        static_assert(!std::is_same_v<U, U>, "var::bind: unsupported parameter type");
+    }
+}
+
+/// Modulo 2^N, a double out of the range of the integer cannot be cast to it
+template<class I>
+I var::convert_integer(double d)
+{
+    using Unsigned = std::make_unsigned_t<I>;
+    if(!std::isfinite(d)){
+        return 0;
+    }
+    auto modulus = std::ldexp(1., std::numeric_limits<Unsigned>::digits);
+    auto wrapped = std::fmod(std::trunc(d), modulus);
+    if(wrapped < 0){
+        wrapped += modulus;
+    }
+    // A tiny negative value is rounded up to the modulus itself
+    return wrapped < modulus ? static_cast<I>(static_cast<Unsigned>(wrapped)) : 0;
+}
+
+template<class T>
+var var::convert_result(T&& result)
+{
+    using U = std::remove_cv_t<std::remove_reference_t<T>>;
+    if constexpr(std::is_arithmetic_v<U> && !std::is_same_v<U, bool>){
+        return static_cast<double>(result);
+    } else if constexpr(std::is_same_v<U, std::string_view>){
+        return std::string(result);
+    } else {
+        return var(std::forward<T>(result));
+    }
+}
+
+/// Function written in script, run by the interpreter that created it
+class ScriptFunction
+{
+public:
+    virtual ~ScriptFunction() = default;
+
+    /// Call from host code
+    virtual var operator()(var::args_t args) = 0;
+    /// The values the function keeps alive, for the cycle collector
+    virtual void for_each_reference(std::function<void(var const&)> const& /*visit*/) const {}
+    /// Memory the function holds besides these values, for the memory accounts
+    virtual size_t memory_size() const { return 0; }
 };
 
 inline std::ostream& operator<<(std::ostream& os, var const& v)
 {
-    return os << v.to_string();
+    std::string storage;
+    return os << v.to_string_view(storage);
 }
 
 inline bool operator==(var const& a, std::string const& b){
@@ -103,7 +1120,11 @@ inline bool operator==(var const& a, double const& b){
 }
 
 inline bool operator==(var const& a, var const& b){
-    return a.to_string() == b.to_string();
+    return a.loose_equals(b);
+}
+
+inline bool operator!=(var const& a, var const& b){
+    return !a.loose_equals(b);
 }
 
 var operator+(var const&, var const&);
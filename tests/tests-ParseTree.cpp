@@ -134,3 +134,45 @@ R"(
 )");
     os.str("");
 }
+
+TEST_CASE("ParseTree-Prune", "[ParseTree]"){
+    ParseTree<std::string> tree("root");
+    auto child0 = tree.root().append("child0");
+    child0.append("child00");
+    child0.append("child01").append("child010");
+    tree.root().append("child1");
+    std::ostringstream os;
+    os << '\n' << tree;
+    CHECK(os.str() ==
+R"(
+1:root
+>1:child0
+>>0:child00
+>>1:child01
+>>>-2:child010
+>-2:child1
+)");
+    os.str("");
+    auto node = tree.at(0);
+    auto descendant = tree.at(1, 0);
+    node.prune(descendant);
+    os << '\n' << tree;
+    CHECK(os.str() ==
+R"(
+1:root
+>1:child01
+>>-1:child010
+>-2:child1
+)");
+    os.str("");
+    auto leaf = tree.at(0, 0);
+    node.prune(leaf);
+    os << '\n' << tree;
+    CHECK(os.str() ==
+R"(
+1:root
+>0:child010
+>-2:child1
+)");
+    os.str("");
+}
@@ -1,6 +1,7 @@
 #include <catch2/catch.hpp>
 
 #include <iostream>
+#include <iterator>
 
 #include "Interpreter.h"
 
@@ -176,6 +177,306 @@ undefined
 7
 )Interpreter");
     }
+    SECTION("Function capture by cell"){
+        is.str("var counter = function(start, step){ var count = start; var inc = function(){ count += step; return count; }; inc(); return function(){ return inc() * 10 + count; }; }; var c = counter(1, 2); c(); c();");
+        auto tree = parser.parse();
+        interpreter.feed(tree);
+
+        os << '\n' << interpreter.execute() << '\n';
+        CHECK(os.str() == R"Interpreter(
+77
+)Interpreter");
+    }
+    SECTION("Function capture of itself"){
+        is.str("var g = function(n){ var fact = function(k){ if(k > 1){ return k * fact(k - 1); } return 1; }; return fact(n); }; g(5);");
+        auto tree = parser.parse();
+        interpreter.feed(tree);
+
+        os << '\n' << interpreter.execute() << '\n';
+        CHECK(os.str() == R"Interpreter(
+120
+)Interpreter");
+    }
+    SECTION("Function created repeatedly"){
+        is.str("var make = function(k){ return function(x){ return x + k; }; }; var a = make(1); var b = make(10); var i = 0; var s = 0; while(i < 3){ s += make(i)(1); i++; } console.log(a(1), ' ', b(1), ' ', s);");
+        interpreter.feed(parser.parse());
+        interpreter.execute();
+        CHECK(os.str() == "2 11 6\n");
+    }
+    SECTION("Tail call"){
+        size_t maxDepth = 0;
+        interpreter.globalEnvironment()["depth"] = var([&](auto){
+            maxDepth = std::max(maxDepth, interpreter.stackDepth());
+            return var();
+        });
+        is.str("var sum = function(n, acc){ if(n == 0){ depth(); return acc; } return sum(n - 1, acc + n); }; var even = function(n){ if(n == 0){ return true; } return odd(n - 1); }; var odd = function(n){ if(n == 0){ return false; } return even(n - 1); }; console.log(sum(100000, 0), ' ', even(10001));");
+        interpreter.feed(parser.parse());
+        interpreter.execute();
+        CHECK(os.str() == "5000050000 false\n");
+        CHECK(maxDepth == 2);
+    }
+    SECTION("Array"){
+        is.str("var a = [1, 2, 3]; a.push(4, 5); a[1] += 10; a[0]++; var s = 0; var i = 0; while(i < a.length){ s += a[i]; i++; } var last = a.pop(); var b = ['x', last]; b[3] = true; console.log(s, ' ', a, ' ', b, ' ', a.length, ' ', [].length);");
+        interpreter.feed(parser.parse());
+        interpreter.execute();
+        CHECK(os.str() == "26 [2,12,3,4] [\"x\",5,undefined,true] 4 0\n");
+    }
+    SECTION("Typed array"){
+        std::vector<double> frame{0.5, 1.5, 2.};
+        interpreter.globalEnvironment()["frame"] = var::typed_array(var::element_type::Float64,
+                                                                    var::array_buffer(frame.data(), frame.size() * sizeof(double)));
+        is.str("var s = 0; var i = 0; while(i < frame.length){ s += frame[i]; frame[i] *= 2; i++; } frame[0]++; console.log(s, ' ', frame.byteLength);");
+        interpreter.feed(parser.parse());
+        interpreter.execute();
+        CHECK(os.str() == "4 24\n");
+        CHECK(frame == std::vector<double>{2., 3., 4.});
+    }
+    SECTION("String building"){
+        is.str("var items = ['a', 'b', 'c']; var html = '<ul>'; var i = 0; while(i < 300){ var k = i % 3; html = html + '<li>' + items[k] + '</li>'; i++; } var open = html; html += '</ul>'; console.log(html == open + '</ul>', ' ', open < html);");
+        interpreter.feed(parser.parse());
+        interpreter.execute();
+        CHECK(os.str() == "true true\n");
+        auto html = interpreter.globalEnvironment()["html"].to_string();
+        CHECK(html.size() == 3009);
+        CHECK(html.substr(html.size() - 15) == "<li>c</li></ul>");
+    }
+    SECTION("Closure cycles"){
+        var::collect_cycles();
+        auto before = var::cycle_collector_stats();
+        var::set_cycle_collection_threshold(64 * 1024);
+        // Each call leaves its environment and the closure it holds referring to each other
+        is.str("var make = function(n){ var f = function(){ return f; }; return n; }; var i = 0; while(i < 2000){ make(i); i++; } console.log(make(i));");
+        interpreter.feed(parser.parse());
+        interpreter.execute();
+        var::collect_cycles();
+        var::set_cycle_collection_threshold(4 << 20);
+        auto after = var::cycle_collector_stats();
+        CHECK(os.str() == "2000\n");
+        CHECK(after.collections > before.collections + 2);
+        CHECK(after.values - before.values == 2 * 2001);
+    }
+    SECTION("Memory limit"){
+        using kind = var::memory_account::kind;
+        auto& memory = interpreter.memory();
+        is.str("var keep = []; var i = 0;");
+        interpreter.feed(parser.parse());
+        interpreter.execute();
+        CHECK(memory.bytes(kind::parse_trees) > 0);
+        CHECK(memory.bytes(kind::objects) > 0);
+
+        auto base = memory.total();
+        memory.set_limit(base + 256 * 1024);
+        is.clear();
+        is.str("while(true){ keep.push({n: i, s: 'longer than an inline string' + i}); i++; }");
+        interpreter.feed(parser.parse());
+        CHECK_THROWS_AS(interpreter.execute(), memory_limit_error);
+        CHECK(interpreter.stackDepth() == 0);
+        CHECK(memory.total() <= memory.limit());
+        CHECK(memory.bytes(kind::strings) > 0);
+
+        // Freed values give their memory back to the account, the buffered roots at the collection
+        interpreter.globalEnvironment()["keep"] = var::array();
+        var::collect_cycles();
+        CHECK(memory.total() < base + 4 * 1024);
+        is.clear();
+        is.str("console.log(i > 100);");
+        interpreter.feed(parser.parse());
+        interpreter.execute();
+        CHECK(os.str() == "true\n");
+
+        // Growth in place is charged before the allocation too
+        is.clear();
+        is.str("var r = ''; i = 0; while(i < 100000){ r += '0123456789012345678901234567890123456789'; i++; }");
+        interpreter.feed(parser.parse());
+        CHECK_THROWS_AS(interpreter.execute(), memory_limit_error);
+        CHECK(memory.total() <= memory.limit());
+        interpreter.globalEnvironment()["r"] = var();
+        is.clear();
+        is.str("var o = {}; i = 0; while(true){ o[i] = i; i++; }");
+        interpreter.feed(parser.parse());
+        CHECK_THROWS_AS(interpreter.execute(), memory_limit_error);
+        CHECK(memory.total() <= memory.limit());
+    }
+    SECTION("Shared script"){
+        is.str("var counter = function(){ var n = 0; return function(){ n++; return n; }; }; var c = counter(); c(); c();");
+        auto script = Interpreter::compile(parser.parse());
+        Interpreter other;
+        auto parseTrees = other.memory().bytes(var::memory_account::kind::parse_trees);
+        interpreter.feed(script);
+        other.feed(script);
+        CHECK(interpreter.execute() == 2.);
+        CHECK(other.execute() == 2.);
+        // Each interpreter keeps its own state, the code is charged to neither
+        CHECK(interpreter.call(interpreter.globalEnvironment()["c"]) == 3.);
+        CHECK(interpreter.call(interpreter.globalEnvironment()["c"]) == 4.);
+        CHECK(other.call(other.globalEnvironment()["c"]) == 3.);
+        CHECK(other.memory().bytes(var::memory_account::kind::parse_trees) == parseTrees);
+    }
+    SECTION("Nested functions"){
+        // Each level declares v<i> = i + 1, the innermost one returns v0 captured from the outermost
+        auto nested = [](int depth){
+            std::string source = "var f = ";
+            for(int i = 0; i < depth; ++i){
+                source += "function(){ var v" + std::to_string(i) + " = " + std::to_string(i + 1) + "; var g = ";
+            }
+            source += "function(){ return v0; }";
+            for(int i = depth; i-- > 0;){
+                source += "; return g() + v" + std::to_string(i) + "; }";
+            }
+            return source + "; f();";
+        };
+        auto compiledSize = [&](int depth){
+            is.clear();
+            is.str(nested(depth));
+            Interpreter fresh;
+            fresh.feed(parser.parse());
+            return fresh.memory().bytes(var::memory_account::kind::parse_trees);
+        };
+
+        is.str(nested(10));
+        interpreter.feed(parser.parse());
+        CHECK(interpreter.execute() == 56.);
+        // A function is compiled once, not again with each enclosing function
+        CHECK(compiledSize(40) < 3 * compiledSize(20));
+    }
+    SECTION("Snapshot"){
+        is.str("var config = {hits: 0}; config.self = config; var hit = function(){ config.hits++; return config.hits; };"
+               "var counter = function(){ var n = 0; return function(){ n++; return n; }; }; var c = counter(); c();");
+        interpreter.feed(parser.parse());
+        interpreter.execute();
+        auto snapshot = interpreter.snapshot();
+        Interpreter first(snapshot);
+        Interpreter second(snapshot);
+        // Each starts where the snapshot was taken, with its own objects and closures
+        CHECK(first.call(first.globalEnvironment()["hit"]) == 1.);
+        CHECK(first.call(first.globalEnvironment()["hit"]) == 2.);
+        CHECK(first.call(first.globalEnvironment()["c"]) == 2.);
+        CHECK(second.call(second.globalEnvironment()["hit"]) == 1.);
+        CHECK(second.call(second.globalEnvironment()["c"]) == 2.);
+        CHECK(interpreter.call(interpreter.globalEnvironment()["hit"]) == 1.);
+        CHECK(first.globalEnvironment()["config"]["self"]["hits"] == 2.);
+        CHECK(first.memory().bytes(var::memory_account::kind::objects) > 0);
+        CHECK(first.memory().bytes(var::memory_account::kind::parse_trees) == 0);
+
+        os.str("");
+        is.clear();
+        is.str("console.log(config.hits + hit(), \",\", c());");
+        first.feed(parser.parse());
+        first.execute();
+        CHECK(os.str() == "5,3\n");
+    }
+    SECTION("Function of another interpreter"){
+        Interpreter other;
+        is.str("var n = 10; var next = function(step){ n += step; return n; };");
+        other.feed(parser.parse());
+        other.execute();
+        interpreter.globalEnvironment()["next"] = other.globalEnvironment()["next"];
+        is.clear();
+        is.str("var n = 0; console.log(next(1), ' ', next(2), ' ', n);");
+        interpreter.feed(parser.parse());
+        interpreter.execute();
+        // It runs on its own interpreter, against its own globals
+        CHECK(os.str() == "11 13 0\n");
+        CHECK(other.globalEnvironment()["n"] == 13.);
+
+        // Kept after its interpreter is gone
+        var orphan;
+        {
+            Interpreter gone;
+            is.clear();
+            is.str("var f = function(){ return 1; };");
+            gone.feed(parser.parse());
+            gone.execute();
+            orphan = gone.globalEnvironment()["f"];
+        }
+        CHECK_THROWS_AS(orphan(), std::logic_error);
+        interpreter.globalEnvironment()["orphan"] = orphan;
+        is.clear();
+        is.str("orphan();");
+        interpreter.feed(parser.parse());
+        CHECK_THROWS_AS(interpreter.execute(), std::logic_error);
+    }
+    SECTION("Time slicing"){
+        for(auto dispatch : {Interpreter::Dispatch::Variant, Interpreter::Dispatch::Threaded}){
+            interpreter.dispatch() = dispatch;
+            os.str("");
+            is.clear();
+            is.str("var i = 0; while(i < 1000){ i++; } console.log(i);");
+            interpreter.feed(parser.parse());
+            int slices = 0;
+            while(interpreter.execute_for(100) == Interpreter::Status::Suspended){
+                ++slices;
+                CHECK(os.str().empty());
+            }
+            CHECK(slices > 10);
+            CHECK(os.str() == "1000\n");
+        }
+
+        // Never ends, but gives the thread back
+        is.clear();
+        is.str("while(true){ i++; }");
+        interpreter.feed(parser.parse());
+        auto steps = interpreter.stepCount();
+        CHECK(interpreter.execute_until(std::chrono::steady_clock::now() + std::chrono::milliseconds(10)) == Interpreter::Status::Suspended);
+        CHECK(interpreter.stackDepth() == 1);
+        CHECK(interpreter.execute_for(50) == Interpreter::Status::Suspended);
+        CHECK(interpreter.stepCount() > steps + 50);
+    }
+    SECTION("Function parameter shadowing"){
+        is.str("var x = 1; var f = function(x){ x += 1; return x; }; console.log(f(5), ' ', x);");
+        interpreter.feed(parser.parse());
+        interpreter.execute();
+        CHECK(os.str() == "6 1\n");
+    }
+    SECTION("Call from host"){
+        interpreter.globalEnvironment()["each"] = var([&interpreter](auto args){
+            var sum = 0.;
+            for(double i = 0; i < args[1].to_double(); ++i){
+                sum += interpreter.call(args[0], i);
+            }
+            return sum;
+        });
+        is.str("var k = 10; var handler = function(x, y){ return x * k + 1; }; var total = each(handler, 4); console.log(total);");
+        interpreter.feed(parser.parse());
+        interpreter.execute();
+
+        auto handler = interpreter.globalEnvironment()["handler"];
+        CHECK(interpreter.call(handler, 2., 3.) == 21.);
+        CHECK(handler({5.}) == 51.);
+        CHECK(os.str() == "64\n");
+    }
+    SECTION("Host function arguments"){
+        interpreter.globalEnvironment()["counter"] = var{{
+            {"count", 0.},
+            {"add", var([](var::args_t args){
+                var self = args.self();
+                for(auto& arg : args){
+                    self["count"] += arg;
+                }
+                return self["count"];
+            })},
+            {"legacy", var([](std::vector<var> args){
+                return var(static_cast<double>(args.size()));
+            })}
+        }};
+        is.str("counter.add(1, 2, 3); var c = counter; c.add(4); console.log(counter.count, ' ', counter.legacy(1, 2), ' ', c.add(1, 2, 3, 4, 5, 6, 7, 8, 9));");
+        interpreter.feed(parser.parse());
+        interpreter.execute();
+        CHECK(os.str() == "10 2 55\n");
+    }
+    SECTION("Method call with a reassigned receiver"){
+        for(bool optimizations : {true, false}){
+            interpreter.optimizations() = optimizations;
+            for(auto dispatch : {Interpreter::Dispatch::Variant, Interpreter::Dispatch::Switch, Interpreter::Dispatch::Threaded}){
+                interpreter.dispatch() = dispatch;
+                is.clear();
+                is.str("var o1 = {f: function(){ return 1; }}; var o2 = {f: function(){ return 2; }}; var o = o1; var h = {o: o1};"
+                       "var s = 0; var i = 0; while(i < 2){ s = s * 10 + o.f(); s = s * 10 + h.o.f(); o = o2; h.o = o2; i++; } s;");
+                interpreter.feed(parser.parse());
+                CHECK(interpreter.execute() == 1122.);
+            }
+        }
+    }
     SECTION("If-Else"){
         is.str("var a = 35; if(a > 30){ console.log(a, ' greater than 30'); } if(a > 40){ console.log(a, ' greater than 40'); } else { console.log(a, ' less than or eq to 40'); }");
         auto tree = parser.parse();
@@ -222,4 +523,66 @@ undefined
 undefined
 )Interpreter");
     }
+    SECTION("Constant If and logical operations"){
+        is.str("if(1 < 2 && 'a'){ console.log('then'); } else { console.log('else'); } if(0 || ''){ console.log('dead'); } 2 * 21;");
+        auto tree = parser.parse();
+        interpreter.feed(tree);
+
+        os << '\n' << interpreter.execute() << '\n';
+        CHECK(os.str() == R"Interpreter(
+then
+42
+)Interpreter");
+    }
+    SECTION("Optimizations disabled"){
+        interpreter.optimizations() = false;
+        is.str("var x = (1 + 19)*5/4%7 - 1;");
+        auto tree = parser.parse();
+        interpreter.feed(tree);
+
+        os << '\n' << interpreter.execute() << '\n';
+        CHECK(os.str() == R"Interpreter(
+3
+)Interpreter");
+    }
+    SECTION("Dispatch modes"){
+        for(auto dispatch : {Interpreter::Dispatch::Variant, Interpreter::Dispatch::Switch, Interpreter::Dispatch::Threaded}){
+            interpreter.dispatch() = dispatch;
+            is.clear();
+            is.str("var g = function(x){ return x * 2; }; var a = 0; var b = 0; while(a < 5){ a += 1; b = g(b) + a; } b;");
+            auto tree = parser.parse();
+            interpreter.feed(tree);
+
+            CHECK(interpreter.execute() == 57);
+        }
+    }
+    SECTION("Equality"){
+        is.str("var o = {}; var p = o; var n = 1; var u; console.log(o === p, ' ', o === {}, ' ', n == '1', ' ', n === '1', ' ', n != 2, ' ', null == u, ' ', null !== u, ' ', 1 + 1 === 2);");
+        interpreter.feed(parser.parse());
+        interpreter.execute();
+        CHECK(os.str() == "true false true false true true true true\n");
+    }
+    SECTION("In-place arithmetic"){
+        is.str("var i = 0; var j = i; var s = 'a'; var t = s; while(i < 3){ i++; s += i * 2 - 1; } var k = i; k--; console.log(i, ' ', j, ' ', k, ' ', s, ' ', t);");
+        interpreter.feed(parser.parse());
+        interpreter.execute();
+        CHECK(os.str() == "3 0 2 a135 a\n");
+    }
+    SECTION("Superinstructions"){
+        char const* source = "var o = {a: 1, b: 2}; var x = 0; var i = 0; while(i < 4){ x = x + o.b; o.a += i; i++; } console.log(x, ' ', o.a, ' ', i);";
+        is.str(source);
+        interpreter.feed(parser.parse());
+        interpreter.execute();
+        auto fusedSteps = interpreter.stepCount();
+
+        interpreter.optimizations() = false;
+        is.clear();
+        is.str(source);
+        interpreter.feed(parser.parse());
+        interpreter.execute();
+        auto genericSteps = interpreter.stepCount() - fusedSteps;
+
+        CHECK(os.str() == "8 7 4\n8 7 4\n");
+        CHECK(fusedSteps < genericSteps);
+    }
 }
@@ -0,0 +1,144 @@
+#include <catch2/catch.hpp>
+
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <random>
+
+#include "Interpreter.h"
+#include "Numeric.h"
+
+TEST_CASE("Numeric kernels", "[numeric]"){
+    // Odd sizes go through the vector loop and the remainder
+    std::vector<double> a{3., -1., 4., 1., -5., 9., 2., 6., 5., 3., 5.};
+    std::vector<double> b(a.size(), 2.);
+    std::vector<double> out(a.size());
+
+    CHECK(Numeric::sum(a.data(), a.size()) == 32.);
+    CHECK(Numeric::min(a.data(), a.size()) == -5.);
+    CHECK(Numeric::max(a.data(), a.size()) == 9.);
+    CHECK(Numeric::dot(a.data(), b.data(), a.size()) == 64.);
+
+    Numeric::scale(a.data(), a.size(), 0.5, out.data());
+    CHECK(out[5] == 4.5);
+    CHECK(out[10] == 2.5);
+    Numeric::add(a.data(), b.data(), a.size(), out.data());
+    CHECK(out[4] == -3.);
+    CHECK(out[10] == 7.);
+    out.resize(Numeric::filterLess(a.data(), a.size(), 3., out.data()));
+    CHECK(out == std::vector<double>{-1., 1., -5., 2.});
+
+    CHECK(Numeric::sum(a.data(), 0) == 0.);
+    CHECK(Numeric::min(a.data(), 0) == INFINITY);
+    CHECK(Numeric::max(a.data(), 0) == -INFINITY);
+    a[6] = NAN;
+    CHECK(std::isnan(Numeric::min(a.data(), a.size())));
+    CHECK(std::isnan(Numeric::max(a.data(), a.size())));
+}
+
+TEST_CASE("Numeric vectorized kernels", "[numeric]"){
+    struct Results
+    {
+        double sum, min, max, dot;
+        std::vector<double> scaled, added, filtered;
+    };
+    auto run = [](double const* a, double const* b, size_t size){
+        Results ret{Numeric::sum(a, size), Numeric::min(a, size), Numeric::max(a, size), Numeric::dot(a, b, size),
+                    std::vector<double>(size), std::vector<double>(size), std::vector<double>(size)};
+        Numeric::scale(a, size, 1.5, ret.scaled.data());
+        Numeric::add(a, b, size, ret.added.data());
+        ret.filtered.resize(Numeric::filterLess(a, size, 10., ret.filtered.data()));
+        return ret;
+    };
+
+    // Each remainder after the vectors, from unaligned data too
+    std::mt19937 random(42);
+    std::uniform_real_distribution<double> values(-100., 100.);
+    for(size_t size = 0; size <= 37; ++size){
+        std::vector<double> a(size + 1), b(size + 1);
+        for(size_t i = 0; i <= size; ++i){
+            a[i] = values(random);
+            b[i] = values(random);
+        }
+        for(size_t offset = 0; offset <= 1; ++offset){
+            Numeric::set_vectorized(false);
+            auto scalar = run(a.data() + offset, b.data() + offset, size);
+            Numeric::set_vectorized(true);
+            auto vectorized = run(a.data() + offset, b.data() + offset, size);
+            CHECK(vectorized.sum == scalar.sum);
+            CHECK(vectorized.min == scalar.min);
+            CHECK(vectorized.max == scalar.max);
+            CHECK(vectorized.dot == scalar.dot);
+            CHECK(vectorized.scaled == scalar.scaled);
+            CHECK(vectorized.added == scalar.added);
+            CHECK(vectorized.filtered == scalar.filtered);
+        }
+
+        // NaN in the vectors or in the remainder
+        a[size] = NAN;
+        for(bool vectorized : {false, true}){
+            Numeric::set_vectorized(vectorized);
+            CHECK(std::isnan(Numeric::min(a.data(), size + 1)));
+            CHECK(std::isnan(Numeric::max(a.data(), size + 1)));
+        }
+    }
+}
+
+TEST_CASE("Numeric library", "[numeric]"){
+    std::istringstream is;
+    std::ostringstream os;
+    Lexer lexer({
+        [&is]{ return is.peek(); },
+        [&is]{ return is.get(); },
+        [&is]{ return is.peek() == decltype(is)::traits_type::eof(); }
+    });
+    Parser parser{lexer};
+    Interpreter interpreter;
+
+    interpreter.globalEnvironment()["console"] = var{{
+        {"log", var(
+            [&os](auto args){
+                std::copy(std::begin(args), std::end(args), std::ostream_iterator<var>(os));
+                os << '\n';
+                return var{};
+            })
+        }
+    }};
+
+    std::vector<double> frame{1., 2., 3., 4., 5.};
+    interpreter.globalEnvironment()["frame"] = var::typed_array(var::element_type::Float64,
+                                                                var::array_buffer(frame.data(), frame.size() * sizeof(double)));
+
+    is.str("var a = [1, 2, 'x']; a[2] = 7; var s = Numeric.scale(frame, 2); console.log(Numeric.sum(frame), ' ', Numeric.max(a), ' ', Numeric.dot(frame, s), ' ', Numeric.add(a, a), ' ', Numeric.filterLess(s, 5));");
+    interpreter.feed(parser.parse());
+    interpreter.execute();
+    CHECK(os.str() == "15 7 110 [2,4,14] [2,4]\n");
+
+    // A Float64Array over unaligned host memory is copied rather than dereferenced
+    std::vector<double> values{3., -1., 4., 1., -5., 9., 2.};
+    std::vector<unsigned char> bytes(values.size() * sizeof(double) + 1);
+    std::memcpy(bytes.data() + 1, values.data(), values.size() * sizeof(double));
+    var unaligned = var::typed_array(var::element_type::Float64,
+                                     var::array_buffer(bytes.data() + 1, values.size() * sizeof(double)));
+    size_t size = 0;
+    CHECK(unaligned.packed_numbers(size) == nullptr);
+    Numeric::set_vectorized(false);
+    double sum = Numeric::sum(values.data(), values.size());
+    double min = Numeric::min(values.data(), values.size());
+    double max = Numeric::max(values.data(), values.size());
+    double dot = Numeric::dot(values.data(), values.data(), values.size());
+    for(bool vectorized : {false, true}){
+        Numeric::set_vectorized(vectorized);
+        CHECK(Numeric::library()["sum"]({unaligned}) == sum);
+        CHECK(Numeric::library()["min"]({unaligned}) == min);
+        CHECK(Numeric::library()["max"]({unaligned}) == max);
+        CHECK(Numeric::library()["dot"]({unaligned, unaligned}) == dot);
+    }
+
+    // The holes of a sparse array are not converted one by one
+    var holes = var::array(std::vector<double>{1., 2.});
+    holes.set(1e9, 3.);
+    CHECK(holes.is_sparse_array());
+    CHECK_THROWS_AS(Numeric::library()["sum"]({holes}), unavailable_operation);
+}
@@ -0,0 +1,110 @@
+#include <catch2/catch.hpp>
+
+#include <iostream>
+
+#include "Optimizer.h"
+
+TEST_CASE("Optimizer", "[optimizer]"){
+    std::istringstream is;
+    std::ostringstream os;
+    Lexer lexer({
+        [&is]{ return is.peek(); },
+        [&is]{ return is.get(); },
+        [&is]{ return is.peek() == decltype(is)::traits_type::eof(); }
+    });
+    Parser parser{lexer};
+    Optimizer optimizer;
+
+    SECTION("Fold arithmetic on literals"){
+        is.str("var x = 60 * 60 * 24;");
+        auto tree = parser.parse();
+        optimizer.optimize(tree.root());
+
+        os << '\n' << tree;
+        CHECK(os.str() == R"Optimizer(
+1:Statement(0:TranslationUnit)
+>1:Statement(1:Expression)
+>>1:VarDecl(name:x)
+>>>-4:Literal(86400)
+)Optimizer");
+    }
+    SECTION("Fold string concatenation"){
+        is.str("var s = 'prefix' + 'suffix';");
+        auto tree = parser.parse();
+        optimizer.optimize(tree.root());
+
+        os << '\n' << tree;
+        CHECK(os.str() == R"Optimizer(
+1:Statement(0:TranslationUnit)
+>1:Statement(1:Expression)
+>>1:VarDecl(name:s)
+>>>-4:Literal(prefixsuffix)
+)Optimizer");
+    }
+    SECTION("Fold grouping and mixed operations"){
+        is.str("var x = (1 + 19)*5/4%7 - 1;");
+        auto tree = parser.parse();
+        optimizer.optimize(tree.root());
+
+        os << '\n' << tree;
+        CHECK(os.str() == R"Optimizer(
+1:Statement(0:TranslationUnit)
+>1:Statement(1:Expression)
+>>1:VarDecl(name:x)
+>>>-4:Literal(3)
+)Optimizer");
+    }
+    SECTION("Partial folding keeps variables"){
+        is.str("var y = x + 1 * 2;");
+        auto tree = parser.parse();
+        optimizer.optimize(tree.root());
+
+        os << '\n' << tree;
+        CHECK(os.str() == R"Optimizer(
+1:Statement(0:TranslationUnit)
+>1:Statement(1:Expression)
+>>1:VarDecl(name:y)
+>>>1:Operation(d00:Addition)
+>>>>0:VarUse(name:x)
+>>>>-5:Literal(2)
+)Optimizer");
+    }
+    SECTION("Constant If condition"){
+        is.str("if(1 < 2){ x; } else { y; } if(0){ z; } if(false) x; else y;");
+        auto tree = parser.parse();
+        optimizer.optimize(tree.root());
+
+        os << '\n' << tree;
+        CHECK(os.str() == R"Optimizer(
+1:Statement(0:TranslationUnit)
+>1:Statement(2:Block)
+>>1:Statement(1:Expression)
+>>>-2:VarUse(name:x)
+>0:Statement(2:Block)
+>1:Statement(1:Expression)
+>>-3:VarUse(name:y)
+)Optimizer");
+    }
+    SECTION("Constant logical operations"){
+        is.str("var a = 0 && b; var c = 1 && b; var d = 1 || b; var e = '' || b;");
+        auto tree = parser.parse();
+        optimizer.optimize(tree.root());
+
+        os << '\n' << tree;
+        CHECK(os.str() == R"Optimizer(
+1:Statement(0:TranslationUnit)
+>1:Statement(1:Expression)
+>>1:VarDecl(name:a)
+>>>-2:Literal(0)
+>1:Statement(1:Expression)
+>>1:VarDecl(name:c)
+>>>-2:VarUse(name:b)
+>1:Statement(1:Expression)
+>>1:VarDecl(name:d)
+>>>-2:Literal(1)
+>1:Statement(1:Expression)
+>>1:VarDecl(name:e)
+>>>-4:VarUse(name:b)
+)Optimizer");
+    }
+}
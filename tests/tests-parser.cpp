@@ -376,7 +376,8 @@ TEST_CASE("Parser", "[parser]"){
         CHECK(os.str() == R"Parser(
 1:Statement(0:TranslationUnit)
 >1:Statement(1:Expression)
->>-1:VarDecl(name:x)
+>>1:VarDecl(name:x)
+>>>-2:Operation(1302:ArrayObject)
 >1:Statement(1:Expression)
 >>1:VarDecl(name:y)
 >>>1:Operation(1302:ArrayObject)
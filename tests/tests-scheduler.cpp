@@ -0,0 +1,145 @@
+#include <catch2/catch.hpp>
+
+#include "var.h"
+
+#if VAR_ATOMIC_REFCOUNT
+#include <sstream>
+
+#include "Scheduler.h"
+
+namespace {
+
+std::shared_ptr<Interpreter> interpreterOf(std::string const& source)
+{
+    std::istringstream is(source);
+    Lexer lexer({
+        [&is]{ return is.peek(); },
+        [&is]{ return is.get(); },
+        [&is]{ return is.peek() == decltype(is)::traits_type::eof(); }
+    });
+    Parser parser{lexer};
+    auto interpreter = std::make_shared<Interpreter>();
+    interpreter->feed(parser.parse());
+    return interpreter;
+}
+
+Interpreter::Script scriptOf(std::string const& source)
+{
+    std::istringstream is(source);
+    Lexer lexer({
+        [&is]{ return is.peek(); },
+        [&is]{ return is.get(); },
+        [&is]{ return is.peek() == decltype(is)::traits_type::eof(); }
+    });
+    Parser parser{lexer};
+    return Interpreter::compile(parser.parse());
+}
+
+} // namespace
+
+TEST_CASE("Scheduler", "[scheduler]"){
+    SECTION("Time slices"){
+        // A single worker still completes the other scripts while one never ends
+        Scheduler scheduler(1, 100);
+        auto endless = scheduler.submit(interpreterOf("while(true){}"));
+        auto done = scheduler.submit(interpreterOf("var i = 0; while(i < 1000){ i++; } i;"));
+        CHECK(done.get() == 1000.);
+        CHECK(endless.wait_for(std::chrono::milliseconds(0)) == std::future_status::timeout);
+    }
+    SECTION("Many interpreters"){
+        Scheduler scheduler(4, 50);
+        std::vector<std::shared_ptr<Interpreter>> interpreters;
+        std::vector<std::future<var>> results;
+        for(int n = 0; n < 200; ++n){
+            interpreters.push_back(interpreterOf(
+                "var make = function(x){ var self = {x: x}; self.self = self; return self; };"
+                "var sum = 0; var i = 0; while(i < " + std::to_string(n) + "){ sum += make(i).x; i++; } sum;"));
+            results.push_back(scheduler.submit(interpreters.back()));
+        }
+        for(int n = 0; n < 200; ++n){
+            CHECK(results[static_cast<size_t>(n)].get() == n * (n - 1) / 2.);
+        }
+        CHECK(interpreters[199]->globalEnvironment()["i"] == 199.);
+    }
+    SECTION("Shared script"){
+        std::istringstream is("var fib = function(n){ if(n < 2){ return n; } return fib(n - 1) + fib(n - 2); }; fib(15);");
+        Lexer lexer({
+            [&is]{ return is.peek(); },
+            [&is]{ return is.get(); },
+            [&is]{ return is.peek() == decltype(is)::traits_type::eof(); }
+        });
+        Parser parser{lexer};
+        auto script = Interpreter::compile(parser.parse());
+
+        Scheduler scheduler(4, 100);
+        std::vector<std::future<var>> results;
+        for(int n = 0; n < 64; ++n){
+            auto interpreter = std::make_shared<Interpreter>();
+            interpreter->feed(script);
+            results.push_back(scheduler.submit(interpreter));
+        }
+        for(auto& result : results){
+            CHECK(result.get() == 610.);
+        }
+    }
+    SECTION("Snapshot"){
+        auto initialized = interpreterOf("var fib = function(n){ if(n < 2){ return n; } return fib(n - 1) + fib(n - 2); };"
+                                         "var stats = {calls: 0};");
+        initialized->execute();
+        auto snapshot = initialized->snapshot();
+        auto script = scriptOf("stats.calls++; fib(10) + stats.calls;");
+
+        // Interpreters started from the snapshot on several threads at once
+        std::vector<std::shared_ptr<Interpreter>> interpreters(64);
+        std::vector<std::thread> threads;
+        for(size_t t = 0; t < 4; ++t){
+            threads.emplace_back([&, t]{
+                for(size_t n = t; n < interpreters.size(); n += 4){
+                    interpreters[n] = std::make_shared<Interpreter>(snapshot);
+                    interpreters[n]->feed(script);
+                }
+            });
+        }
+        for(auto& thread : threads){
+            thread.join();
+        }
+
+        Scheduler scheduler(4, 100);
+        std::vector<std::future<var>> results;
+        for(auto& interpreter : interpreters){
+            results.push_back(scheduler.submit(interpreter));
+        }
+        for(auto& result : results){
+            CHECK(result.get() == 56.);
+        }
+    }
+    SECTION("Results read while other scripts run"){
+        var::collect_cycles();
+        Scheduler scheduler(4, 50);
+        std::vector<std::future<var>> results;
+        for(int n = 0; n < 200; ++n){
+            results.push_back(scheduler.submit(interpreterOf(
+                "var make = function(x){ var self = {x: x, list: []}; self.self = self; self.list.push(self); return self; };"
+                "var last = make(0); var i = 0; while(i < " + std::to_string(n % 20 * 10) + "){ last = make(i); i++; } last;")));
+        }
+        for(int n = 0; n < 200; ++n){
+            // The other scripts go on running and collecting on the workers meanwhile
+            auto result = results[static_cast<size_t>(n)].get();
+            CHECK(result["self"]["list"][0.]["x"] == (n % 20 == 0 ? 0. : n % 20 * 10 - 1.));
+            result["self"]["x"] = double(n);
+            result["list"].set(1., result);
+            CHECK(result["list"].get("length") == 2.);
+            CHECK(result["list"][1.]["x"] == double(n));
+        }
+        // Each result is left to the host as a cycle of an object and an array
+        CHECK(var::collect_cycles() == 400);
+    }
+    SECTION("Errors"){
+        Scheduler scheduler(2);
+        auto interpreter = interpreterOf("var keep = []; while(true){ keep.push({}); }");
+        interpreter->memory().set_limit(interpreter->memory().total() + 64 * 1024);
+        auto result = scheduler.submit(interpreter);
+        CHECK_THROWS_AS(result.get(), memory_limit_error);
+    }
+}
+#endif
@@ -1,6 +1,9 @@
 #include <catch2/catch.hpp>
 
+#include <condition_variable>
 #include <iostream>
+#include <mutex>
+#include <thread>
 
 #include "var.h"
 
@@ -43,3 +46,438 @@ TEST_CASE("Var with prototype", "[var]"){
     os << b["foo"];
     CHECK(os.str() == "FOO");
 }
+
+TEST_CASE("Var compound assignment", "[var]"){
+    std::ostringstream os;
+
+    var a = 1.;
+    var b = a;
+    a += 2.;
+    ++a;
+    a *= 3.;
+    os << a << " " << b;
+    CHECK(os.str() == "12 1");
+
+    os.str("");
+
+    var s = "abc";
+    var t = s;
+    s += "def";
+    s += 1.;
+    os << s << " " << t;
+    CHECK(os.str() == "abcdef1 abc");
+
+    os.str("");
+
+    var i = 5.;
+    var old = i++;
+    i %= 4.;
+    i -= 0.5;
+    os << old << " " << i << " " << var(2 < 3);
+    CHECK(os.str() == "5 1.5 true");
+
+    CHECK(var("abc") < var("abd"));
+    CHECK(var("10") < var("9"));
+    CHECK((var(10.) < var(9.)) == false);
+}
+
+TEST_CASE("Var equality", "[var]"){
+    var obj{{{"a", 1.}}};
+    var sameObj = obj;
+    var otherObj{{{"a", 1.}}};
+    var nan = NAN;
+
+    CHECK(obj.strict_equals(sameObj));
+    CHECK(!obj.strict_equals(otherObj));
+    CHECK(!nan.strict_equals(nan));
+    CHECK(!nan.loose_equals(nan));
+    CHECK(var(1.).strict_equals(var(1.)));
+    CHECK(!var(1.).strict_equals(var("1")));
+    CHECK(var(1.).loose_equals(var("1")));
+    CHECK(var(true).loose_equals(var(1.)));
+    CHECK(!var(true).loose_equals(var("true")));
+    CHECK(var(nullptr).loose_equals(var::undefined));
+    CHECK(!var(nullptr).strict_equals(var::undefined));
+    CHECK(!var(nullptr).loose_equals(var(0.)));
+    CHECK(!obj.loose_equals(var(R"({"a":1})")));
+    CHECK(obj.loose_equals(var("[object Object]")));
+    CHECK(var::array(std::vector<double>{1.}).loose_equals(var(1.)));
+    CHECK(var::array(std::vector<double>{1., 2.}).loose_equals(var("1,2")));
+    CHECK(!var::array(std::vector<double>{1., 2.}).loose_equals(var("[1,2]")));
+    CHECK(var("b,,").loose_equals(var::array({var("b"), var(nullptr), var::undefined})));
+    CHECK(var::array().loose_equals(var("")));
+    CHECK(obj == sameObj);
+    CHECK(obj != otherObj);
+}
+
+namespace {
+
+int clampedSum(int a, int b, int max){ return std::min(a + b, max); }
+std::string_view firstWord(std::string_view text){ return text.substr(0, text.find(' ')); }
+std::string repeat(std::string const& text, unsigned count)
+{
+    std::string ret;
+    for(unsigned i = 0; i < count; ++i){
+        ret += text;
+    }
+    return ret;
+}
+bool notified = false;
+void notify(bool value){ notified = value; }
+
+}
+
+TEST_CASE("Var bind", "[var]"){
+    std::ostringstream os;
+
+    var sum = var::bind<&clampedSum>();
+    var word = var::bind<&firstWord>();
+    var rep = var::bind(&repeat);
+    var note = var::bind<&notify>();
+
+    os << sum({2.7, 3., 10.}) << " " << sum({8., "9", 10.}) << " "
+       << word({"hello world"}) << " " << word({42.}) << " " << rep({"ab", 3.});
+    CHECK(os.str() == "5 10 hello 42 ababab");
+
+    CHECK(note({true}).is_undefined());
+    CHECK(notified);
+    CHECK(rep({"ab"}).to_string().empty());
+
+    // Integers wrap around, NaN and infinities give 0
+    CHECK(sum({4294967298.5, -1., 10.}) == 1.);
+    CHECK(sum({std::nan(""), 1e300, 10.}) == 0.);
+    CHECK(sum({-std::numeric_limits<double>::infinity(), 2147483648., 10.}) == -2147483648.);
+    CHECK(rep({"ab", 4294967298.}).to_string() == "abab");
+}
+
+TEST_CASE("Var host function storage", "[var]"){
+    std::array<double, 8> weights{1., 2., 3., 4., 5., 6., 7., 8.};
+    double offset = 100.;
+
+    var::function_t small = [&offset](var::args_t args){ return var(args[0].to_double() + offset); };
+    var::function_t large = [weights](var::args_t args){
+        double sum = 0;
+        for(size_t i = 0; i < weights.size(); ++i){
+            sum += weights[i] * args[i].to_double();
+        }
+        return var(sum);
+    };
+    std::vector<var> args{1., 1., 1.};
+
+    auto smallCopy = small;
+    auto largeCopy = large;
+    auto largeMoved = std::move(large);
+    CHECK_FALSE(large);
+    CHECK(smallCopy(args) == 101.);
+    CHECK(largeCopy(args) == 6.);
+    CHECK(largeMoved(args) == 6.);
+    CHECK_THROWS_AS(large(args), std::bad_function_call);
+
+    small = largeCopy;
+    CHECK(small(args) == 6.);
+    CHECK(var(std::move(smallCopy))({2.}) == 102.);
+}
+
+TEST_CASE("Var array", "[var]"){
+    var numbers = var::array(std::vector<double>{1., 2.});
+    numbers.set(2., 3.);
+    numbers.set(1., numbers.get(1.) * 10.);
+    CHECK(numbers.is_array());
+    CHECK(numbers.get("length") == 3.);
+    CHECK(numbers.to_string() == "[1,20,3]");
+    CHECK(numbers.get(3.).is_undefined());
+
+    numbers.set(0., "a");
+    numbers.set(4., true);
+    CHECK(numbers.to_string() == R"(["a",20,3,undefined,true])");
+    numbers.set("length", 2.);
+    CHECK(numbers.to_string() == R"(["a",20])");
+
+    var const& constNumbers = numbers;
+    CHECK(constNumbers[1.] == 20.);
+    CHECK(constNumbers["push"].is_undefined());
+
+    // Read without boxing the numbers
+    var const packed = var::array(std::vector<double>{4., 5.});
+    size_t size;
+    CHECK(packed[1.] == 5.);
+    CHECK(packed.packed_numbers(size) != nullptr);
+
+    var mixed = var::array({var("b"), var(nullptr)});
+    CHECK(mixed.to_string() == R"(["b",null])");
+    CHECK(var::array().to_string() == "[]");
+}
+
+TEST_CASE("Var sparse array", "[var]"){
+    var arr = var::array(std::vector<double>{1., 2.});
+    // Far past the end: the holes take no memory
+    arr.set(4e9, "far");
+    CHECK(arr.get("length") == 4e9 + 1);
+    CHECK(arr.get(1.) == 2.);
+    CHECK(arr.get(5.).is_undefined());
+    CHECK(arr.get(4e9).to_string() == "far");
+    arr[3.] = 4.;
+    CHECK(arr.to_string() == R"([1,2,<1 empty items>,4,<3999999996 empty items>,"far"])");
+
+    CHECK(arr.get("pop")(var::args_t(nullptr, 0, &arr)).to_string() == "far");
+    CHECK(arr.get("length") == 4e9);
+    arr.set("length", 3.);
+    CHECK(arr.to_string() == "[1,2,<1 empty items>]");
+    arr.set("length", 1e9);
+    CHECK(arr.get("length") == 1e9);
+
+    // Growing element by element stays packed
+    var dense = var::array();
+    for(double i = 0; i < 5000; ++i){
+        dense.set(i, i);
+    }
+    size_t size = 0;
+    CHECK(dense.packed_numbers(size) != nullptr);
+    CHECK(size == 5000);
+}
+
+TEST_CASE("Var typed array", "[var]"){
+    std::array<double, 4> frame{1., 2., 3., 4.};
+    var buffer = var::array_buffer(frame.data(), sizeof(frame));
+    var samples = var::typed_array(var::element_type::Float64, buffer);
+
+    CHECK(samples.is_typed_array());
+    CHECK(samples.data() == reinterpret_cast<std::byte*>(frame.data()));
+    CHECK(samples.get("length") == 4.);
+    samples.set(1., 2.5);
+    frame[2] = 7.;
+    CHECK(frame[1] == 2.5);
+    CHECK(samples.get(2.) == 7.);
+    samples.set(4., 9.);
+    CHECK(samples.get(4.).is_undefined());
+    CHECK(samples.to_string() == "[1,2.5,7,4]");
+
+    var tail = var::typed_array(var::element_type::Float64, buffer, 2 * sizeof(double), 1);
+    CHECK(tail.to_string() == "[7]");
+    CHECK(tail.byte_length() == sizeof(double));
+    CHECK_THROWS_AS(var::typed_array(var::element_type::Int32, buffer, 2), std::invalid_argument);
+    CHECK_THROWS_AS(var::typed_array(var::element_type::Float64, buffer, 0, 5), std::invalid_argument);
+
+    var integers = var::typed_array(var::element_type::Int32, 3);
+    integers.set(0., 4294967297.);
+    integers.set(1., -1.5);
+    integers.set(2., NAN);
+    CHECK(integers.to_string() == "[1,-1,0]");
+
+    var bytes = var::typed_array(var::element_type::Uint8, integers.get("buffer"), 4);
+    bytes.set(0., 300.);
+    CHECK(bytes.get(0.) == 44.);
+    CHECK(bytes.get(1.) == 255.);
+    CHECK(integers.get(1.) == -212.);
+}
+
+TEST_CASE("Var rope", "[var]"){
+    std::string expected;
+    var text = "";
+    for(int i = 0; i < 100; ++i){
+        text = text + "line " + var(static_cast<double>(i)) + "\n";
+        expected += "line " + std::to_string(i) + "\n";
+    }
+    var prefix = text;
+    var withA = text + "a";
+    var withB = text + "b";
+    text += "!";
+
+    CHECK(text.to_string() == expected + "!");
+    CHECK(prefix.to_string() == expected);
+    CHECK(withA.strict_equals(var(expected + "a")));
+    CHECK(withB.loose_equals(var(expected + "b")));
+    CHECK(prefix < withA);
+    CHECK(var::array({prefix}).to_string().front() == '[');
+    CHECK(var::array({withB}).to_string()[1] == '"');
+
+    // Appended to itself, the rope is read before it grows
+    var doubled = text + "?";
+    doubled += "?";
+    doubled += doubled;
+    CHECK(doubled.to_string() == expected + "!??" + expected + "!??");
+}
+
+TEST_CASE("Var string", "[var]"){
+    std::string storage;
+    var shortStr = "key";
+    var longStr = std::string(40, 'x');
+    var copy = var(longStr.to_string());
+
+    CHECK(shortStr.to_string_view(storage) == "key");
+    CHECK(longStr.to_string_view(storage).data() == longStr.to_string_view(storage).data());
+    CHECK(storage.empty());
+    CHECK(var(3.).to_string_view(storage) == "3");
+    CHECK(storage == "3");
+
+    auto key = longStr.to_key();
+    CHECK(key.data() == longStr.to_string_view(storage).data());
+    CHECK(key.hash() == std::hash<std::string_view>{}(std::string(40, 'x')));
+    CHECK(key == copy.to_key());
+    CHECK(var(key).strict_equals(copy));
+    CHECK(var::string_t("abc") < var::string_t("abd"));
+
+    var obj{{{"key", 1.}}};
+    obj[longStr] = 2.;
+    CHECK(obj[key].to_double() == 2.);
+    CHECK(obj[shortStr.to_key()].to_double() == 1.);
+    CHECK(obj.get(copy).to_double() == 2.);
+}
+
+TEST_CASE("Var shared constants", "[var]"){
+    // Booleans, null and the array methods are shared by every thread, even without atomic reference counts
+    var array = var::array(std::vector<double>{1., 2.});
+    std::thread([]{
+        for(int i = 0; i < 1000; ++i){
+            var flags = var::array({true, false, nullptr});
+            var push = var::array().get("push");
+        }
+    }).join();
+    var pop = array.get("pop");
+    CHECK(pop(var::args_t(nullptr, 0, &array)).to_double() == 2.);
+    CHECK(var(true).strict_equals(var(1.) < var(2.)));
+    CHECK(var(nullptr).is_null());
+}
+
+TEST_CASE("Var cycle collection", "[var]"){
+    var::collect_cycles();
+    auto before = var::cycle_collector_stats();
+    var kept;
+    {
+        var self{std::unordered_map<std::string, var>{}};
+        self["self"] = self;
+        var a{std::unordered_map<std::string, var>{}};
+        var b{{{"a", a}}};
+        a["b"] = b;
+        var list = var::array();
+        list.set(0., list);
+        list.set(1., "x");
+        var hostOwned{std::unordered_map<std::string, var>{}};
+        hostOwned["self"] = hostOwned;
+        kept = var([hostOwned](auto){ return hostOwned; });
+        var live{std::unordered_map<std::string, var>{}};
+        live["self"] = live;
+        live["name"] = "live";
+        kept = var{{{"live", live}, {"host", kept}}};
+    }
+    CHECK(var::collect_cycles() == 4);
+    auto after = var::cycle_collector_stats();
+    CHECK(after.collections == before.collections + 1);
+    CHECK(after.values == before.values + 4);
+    CHECK(after.bytes > before.bytes);
+    CHECK(kept["live"]["self"]["name"].to_string() == "live");
+    CHECK(kept["host"]()["self"].is_undefined() == false);
+    CHECK(var::collect_cycles() == 0);
+    // Released with the host function capturing it
+    kept = var();
+    CHECK(var::collect_cycles() == 2);
+}
+
+TEST_CASE("Var clone", "[var]"){
+    var shared{{{"n", 1.}}};
+    var original{{{"a", shared}, {"b", shared}, {"list", var::array({shared, var("x")})}}};
+    original["self"] = original;
+    var copy = var::cloner()(original);
+    // Same sharing and loops, between the copies only
+    CHECK(copy["a"].strict_equals(copy["b"]));
+    CHECK(copy.get("list").get(0.).strict_equals(copy["a"]));
+    CHECK(copy["self"].strict_equals(copy));
+    CHECK(!copy["a"].strict_equals(original["a"]));
+    copy["a"]["n"] = 2.;
+    CHECK(copy["b"]["n"] == 2.);
+    CHECK(original["b"]["n"] == 1.);
+    CHECK(copy.get("list").get(1.).to_string() == "x");
+    original["self"] = var();
+    copy["self"] = var();
+
+    std::string text(300, 'r');
+    var rope = var(text.substr(0, 150)) + var(text.substr(150));
+    var holder{{{"rope", rope}}};
+    var copied = var::cloner()(holder);
+    rope = rope + "!";
+    CHECK(copied["rope"].to_string() == text);
+    CHECK(holder["rope"].to_string() == text);
+    CHECK(rope.to_string() == text + "!");
+
+    // The bytes of the engine are copied, views of one buffer still share it; host memory stays shared
+    std::vector<double> host{1., 2.};
+    var bytes = var::array_buffer(16);
+    var views{{{"all", var::typed_array(var::element_type::Float64, bytes)},
+               {"last", var::typed_array(var::element_type::Float64, bytes, 8)},
+               {"host", var::typed_array(var::element_type::Float64, var::array_buffer(host.data(), 16))}}};
+    var viewsCopy = var::cloner()(views);
+    viewsCopy["all"].set(1., 5.);
+    viewsCopy["host"].set(0., 7.);
+    CHECK(viewsCopy["last"].get(0.) == 5.);
+    CHECK(views["last"].get(0.) == 0.);
+    CHECK(views["host"].get(0.) == 7.);
+    CHECK(host[0] == 7.);
+
+    // Script functions may hold cycles, they are never shared by the copy
+    struct Constant: ScriptFunction
+    {
+        var operator()(var::args_t) override { return 1.; }
+    };
+    var withFunction{{{"f", var(std::make_shared<Constant>())}}};
+    CHECK_THROWS_AS(var::cloner()(withFunction), std::invalid_argument);
+}
+
+// Values move between threads, which single threaded builds forbid
+#if VAR_ATOMIC_REFCOUNT
+TEST_CASE("Var heap", "[var]"){
+    // Values outliving the thread that created them, then freed and reused by this one
+    std::vector<var> values;
+    std::thread([&values]{
+        for(int i = 0; i < 5000; ++i){
+            values.push_back(var(static_cast<double>(i)) + 0.5);
+        }
+        var garbage = var::array(std::vector<double>(100, 1.));
+    }).join();
+    double sum = 0.;
+    for(auto& value : values){
+        sum += value.to_double();
+    }
+    CHECK(sum == 5000. * 4999. / 2. + 2500.);
+    values.clear();
+    for(int i = 0; i < 5000; ++i){
+        values.push_back(var{{{"i", static_cast<double>(i)}}});
+    }
+    CHECK(values[4999]["i"].to_double() == 4999.);
+}
+
+TEST_CASE("Var heap freed by another thread", "[var]"){
+    // A thread keeps producing values which this one frees, as a scheduler and its host do
+    std::mutex mutex;
+    std::condition_variable handover;
+    std::vector<var> values;
+    bool produced = false;
+    size_t warmedUp = 0;
+    std::thread producer([&]{
+        for(int round = 0; round < 20; ++round){
+            std::vector<var> batch;
+            for(int i = 0; i < 100000; ++i){
+                batch.push_back(var{{{"i", static_cast<double>(i)}}});
+            }
+            std::unique_lock lock(mutex);
+            handover.wait(lock, [&]{ return !produced; });
+            values = std::move(batch);
+            produced = true;
+            handover.notify_all();
+        }
+    });
+    for(int round = 0; round < 20; ++round){
+        std::unique_lock lock(mutex);
+        handover.wait(lock, [&]{ return produced; });
+        CHECK(values[99999]["i"].to_double() == 99999.);
+        values.clear();
+        produced = false;
+        handover.notify_all();
+        if(round == 2){
+            warmedUp = var::heap_size();
+        }
+    }
+    producer.join();
+    // The nodes freed here go back to the producer, instead of about 20 MiB of new chunks each round
+    CHECK(var::heap_size() <= warmedUp + 8 * 1024 * 1024);
+}
+#endif